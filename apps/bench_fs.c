@@ -0,0 +1,462 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <fs.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+#define bench_fs_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	bench_fs_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+#define die_perror(msg)			\
+do {							\
+	perror(msg);				\
+	exit(1);					\
+} while (0)
+
+/* Name of the file used by the read and write workloads */
+#define BENCH_FILENAME "bench_file"
+
+/* Largest number of request sizes given with -r */
+#define BENCH_MAX_REQ_SIZES 16
+
+/* Parameters of a run, set from the command line */
+struct bench_config {
+	char *diskname;
+	/* Size of the file read or written, 0 to pick it from the free space */
+	size_t file_size;
+	/* Request sizes, each one measured separately */
+	size_t req_sizes[BENCH_MAX_REQ_SIZES];
+	size_t nreq_sizes;
+	/* Number of random requests, or of churn and mount rounds */
+	size_t count;
+	/* Library settings */
+	size_t cache_size;
+	int mmap;
+	int lazy;
+	size_t journal;
+	/* Block trace file, NULL to record none */
+	char *trace;
+};
+
+/* Latency of each operation of a run, in nanoseconds */
+struct bench_samples {
+	long long *ns;
+	size_t count;
+	size_t capacity;
+};
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void samples_add(struct bench_samples *s, long long ns)
+{
+	if (s->count == s->capacity) {
+		s->capacity = s->capacity ? s->capacity * 2 : 1024;
+		s->ns = realloc(s->ns, s->capacity * sizeof(*s->ns));
+		if (!s->ns)
+			die_perror("realloc");
+	}
+	s->ns[s->count++] = ns;
+}
+
+static int cmp_ns(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile_us(struct bench_samples *s, double p)
+{
+	size_t i;
+
+	if (!s->count)
+		return 0;
+	i = (size_t)(p / 100 * (s->count - 1) + 0.5);
+	return s->ns[i] / 1000.0;
+}
+
+/*
+ * Print one JSON object per line, so that results can be appended to a file
+ * and compared across commits
+ */
+static void report(struct bench_config *cfg, const char *workload,
+		   size_t req_size, size_t bytes, long long total_ns,
+		   struct bench_samples *s)
+{
+	double seconds = total_ns / 1e9;
+
+	qsort(s->ns, s->count, sizeof(*s->ns), cmp_ns);
+	printf("{\"workload\":\"%s\",\"req_size\":%zu,\"ops\":%zu,"
+	       "\"bytes\":%zu,\"seconds\":%.6f,\"ops_per_sec\":%.1f,"
+	       "\"mb_per_sec\":%.2f,\"lat_p50_us\":%.2f,\"lat_p90_us\":%.2f,"
+	       "\"lat_p99_us\":%.2f,\"lat_max_us\":%.2f,\"cache\":%zu,"
+	       "\"backend\":\"%s\",\"fat\":\"%s\",\"journal\":%zu}\n",
+	       workload, req_size, s->count, bytes, seconds,
+	       seconds > 0 ? s->count / seconds : 0,
+	       seconds > 0 ? bytes / seconds / (1024 * 1024) : 0,
+	       percentile_us(s, 50), percentile_us(s, 90),
+	       percentile_us(s, 99), percentile_us(s, 100),
+	       cfg->cache_size, cfg->mmap ? "mmap" : "file",
+	       cfg->lazy ? "lazy" : "eager", cfg->journal);
+	fflush(stdout);
+	s->count = 0;
+}
+
+static void bench_mount(struct bench_config *cfg)
+{
+	if (fs_set_cache_size(cfg->cache_size) ||
+	    fs_set_disk_backend(cfg->mmap ? FS_DISK_MMAP : FS_DISK_FILE) ||
+	    fs_set_fat_loading(cfg->lazy ? FS_FAT_LAZY : FS_FAT_EAGER) ||
+	    fs_set_journal_size(cfg->journal) ||
+	    fs_set_trace(cfg->trace))
+		die("Cannot configure file system");
+
+	if (fs_mount(cfg->diskname))
+		die("Cannot mount diskname");
+}
+
+static void bench_umount(void)
+{
+	if (fs_umount())
+		die("Cannot unmount diskname");
+}
+
+/* Default file size: most of the free space, up to 16 MiB */
+static size_t bench_file_size(struct bench_config *cfg)
+{
+	struct fs_statfs st;
+	size_t size;
+
+	if (cfg->file_size)
+		return cfg->file_size;
+
+	bench_mount(cfg);
+	if (fs_statfs(&st))
+		die("Cannot get file system usage");
+	bench_umount();
+
+	size = st.data_blk_free * 3 / 4 * st.blk_size;
+	if (size > 16 * 1024 * 1024)
+		size = 16 * 1024 * 1024;
+	if (!size)
+		die("No free space on diskname");
+
+	return size;
+}
+
+/* Create the benchmark file, with @size bytes of content if @size is not 0 */
+static int bench_prepare(size_t size)
+{
+	static char buf[65536];
+	size_t off, len;
+	int fd;
+
+	fs_delete(BENCH_FILENAME);
+	if (fs_create(BENCH_FILENAME))
+		die("Cannot create file");
+	fd = fs_open(BENCH_FILENAME);
+	if (fd < 0)
+		die("Cannot open file");
+
+	memset(buf, 'b', sizeof(buf));
+	for (off = 0; off < size; off += len) {
+		len = size - off < sizeof(buf) ? size - off : sizeof(buf);
+		if (fs_write(fd, buf, len) != (int)len)
+			die("Cannot write file");
+	}
+
+	return fd;
+}
+
+static void bench_cleanup(int fd)
+{
+	if (fs_close(fd) || fs_delete(BENCH_FILENAME))
+		die("Cannot remove file");
+}
+
+static void bench_rw(struct bench_config *cfg, const char *workload,
+		     int is_write, int is_random)
+{
+	struct bench_samples s = { 0 };
+	size_t size = bench_file_size(cfg);
+	unsigned int seed = 1;
+	size_t i, r, nops, off, bytes;
+	long long start, t;
+	char *buf;
+	int fd, ret;
+
+	for (r = 0; r < cfg->nreq_sizes; r++) {
+		size_t req_size = cfg->req_sizes[r];
+
+		if (req_size > size || req_size > INT_MAX)
+			die("Request size %zu larger than file", req_size);
+		buf = malloc(req_size);
+		if (!buf)
+			die_perror("malloc");
+		memset(buf, 'w', req_size);
+
+		/*
+		 * Reads and random writes work on an existing file, read from a
+		 * fresh mount so that nothing is cached yet
+		 */
+		bench_mount(cfg);
+		fd = bench_prepare(is_write && !is_random ? 0 : size);
+		if (fs_close(fd))
+			die("Cannot close file");
+		bench_umount();
+		bench_mount(cfg);
+		fd = fs_open(BENCH_FILENAME);
+		if (fd < 0)
+			die("Cannot open file");
+
+		nops = is_random ? cfg->count : size / req_size;
+		bytes = 0;
+		start = now_ns();
+		for (i = 0; i < nops; i++) {
+			if (is_random) {
+				off = (size_t)rand_r(&seed) % (size - req_size + 1);
+				if (fs_lseek(fd, off))
+					die("Cannot seek file");
+			}
+			t = now_ns();
+			if (is_write)
+				ret = fs_write(fd, buf, req_size);
+			else
+				ret = fs_read(fd, buf, req_size);
+			samples_add(&s, now_ns() - t);
+			if (ret != (int)req_size)
+				die("Short %s", is_write ? "write" : "read");
+			bytes += ret;
+		}
+		/* Written data is only done once it reaches the disk */
+		if (is_write && fs_sync())
+			die("Cannot sync");
+		report(cfg, workload, req_size, bytes, now_ns() - start, &s);
+
+		bench_cleanup(fd);
+		bench_umount();
+		free(buf);
+	}
+	free(s.ns);
+}
+
+static void bench_seqwrite(struct bench_config *cfg)
+{
+	bench_rw(cfg, "seqwrite", 1, 0);
+}
+
+static void bench_seqread(struct bench_config *cfg)
+{
+	bench_rw(cfg, "seqread", 0, 0);
+}
+
+static void bench_randwrite(struct bench_config *cfg)
+{
+	bench_rw(cfg, "randwrite", 1, 1);
+}
+
+static void bench_randread(struct bench_config *cfg)
+{
+	bench_rw(cfg, "randread", 0, 1);
+}
+
+/* Fill the root directory with small files, then delete them all */
+static void bench_churn(struct bench_config *cfg)
+{
+	struct bench_samples s = { 0 };
+	struct fs_statfs st;
+	char name[FS_FILENAME_LEN];
+	size_t i, round, nfiles;
+	long long start, t;
+
+	bench_mount(cfg);
+	if (fs_statfs(&st))
+		die("Cannot get file system usage");
+	nfiles = st.rdir_free;
+
+	start = now_ns();
+	for (round = 0; round < cfg->count; round++) {
+		for (i = 0; i < nfiles; i++) {
+			snprintf(name, sizeof(name), "churn%d", (int)(i % FS_FILE_MAX_COUNT));
+			t = now_ns();
+			if (fs_create(name))
+				die("Cannot create file");
+			samples_add(&s, now_ns() - t);
+		}
+		for (i = 0; i < nfiles; i++) {
+			snprintf(name, sizeof(name), "churn%d", (int)(i % FS_FILE_MAX_COUNT));
+			t = now_ns();
+			if (fs_delete(name))
+				die("Cannot delete file");
+			samples_add(&s, now_ns() - t);
+		}
+	}
+	report(cfg, "churn", 0, 0, now_ns() - start, &s);
+
+	bench_umount();
+	free(s.ns);
+}
+
+static void bench_mount_umount(struct bench_config *cfg)
+{
+	struct bench_samples s = { 0 };
+	long long start, t;
+	size_t i;
+
+	start = now_ns();
+	for (i = 0; i < cfg->count; i++) {
+		t = now_ns();
+		bench_mount(cfg);
+		bench_umount();
+		samples_add(&s, now_ns() - t);
+	}
+	report(cfg, "mount", 0, 0, now_ns() - start, &s);
+
+	free(s.ns);
+}
+
+static void bench_all(struct bench_config *cfg)
+{
+	bench_seqwrite(cfg);
+	bench_seqread(cfg);
+	bench_randwrite(cfg);
+	bench_randread(cfg);
+	bench_churn(cfg);
+	bench_mount_umount(cfg);
+}
+
+static struct {
+	const char *name;
+	void(*func)(struct bench_config *);
+} workloads[] = {
+	{ "seqwrite",	bench_seqwrite },
+	{ "seqread",	bench_seqread },
+	{ "randwrite",	bench_randwrite },
+	{ "randread",	bench_randread },
+	{ "churn",	bench_churn },
+	{ "mount",	bench_mount_umount },
+	{ "all",	bench_all }
+};
+
+void usage(char *program)
+{
+	size_t i;
+	fprintf(stderr, "Usage: %s [options] <workload> <diskname>\n", program);
+	fprintf(stderr, "Possible workloads are:\n");
+	for (i = 0; i < ARRAY_SIZE(workloads); i++)
+		fprintf(stderr, "\t%s\n", workloads[i].name);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "\t-s <bytes>\tfile size (default: most of the free space, up to 16 MiB)\n");
+	fprintf(stderr, "\t-r <bytes>[,<bytes>...]\trequest sizes (default: 512,4096,65536)\n");
+	fprintf(stderr, "\t-n <count>\trandom requests, or churn and mount rounds (default: 1000)\n");
+	fprintf(stderr, "\t-c <blocks>\tblock cache size (default: %d)\n", FS_CACHE_DEFAULT_BLOCKS);
+	fprintf(stderr, "\t-m\t\tmemory-map the disk\n");
+	fprintf(stderr, "\t-l\t\tload the FAT lazily\n");
+	fprintf(stderr, "\t-j <blocks>\treserve a journal if the disk has none (modifies the disk)\n");
+	fprintf(stderr, "\t-t <trace>\trecord the block accesses of the last mount, for trace_replay.x\n");
+	fprintf(stderr, "The disk must have been created with fs_make.x or fs_format.x. Results are printed as one JSON object per line.\n");
+	exit(1);
+}
+
+size_t get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX)
+		die_perror("strtol");
+	if (ret < 0)
+		die("Invalid number '%s'", argv);
+	return (size_t)ret;
+}
+
+static void parse_req_sizes(struct bench_config *cfg, char *list)
+{
+	char *tok;
+
+	cfg->nreq_sizes = 0;
+	for (tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+		if (cfg->nreq_sizes == BENCH_MAX_REQ_SIZES)
+			die("Too many request sizes");
+		cfg->req_sizes[cfg->nreq_sizes] = get_argv(tok);
+		if (!cfg->req_sizes[cfg->nreq_sizes])
+			die("Invalid request size '%s'", tok);
+		cfg->nreq_sizes++;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_config cfg = {
+		.req_sizes = { 512, 4096, 65536 },
+		.nreq_sizes = 3,
+		.count = 1000,
+		.cache_size = FS_CACHE_DEFAULT_BLOCKS,
+	};
+	char *program = argv[0];
+	size_t i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:r:n:c:mlj:t:")) != -1) {
+		switch (opt) {
+		case 's':
+			cfg.file_size = get_argv(optarg);
+			break;
+		case 'r':
+			parse_req_sizes(&cfg, optarg);
+			break;
+		case 'n':
+			cfg.count = get_argv(optarg);
+			break;
+		case 'c':
+			cfg.cache_size = get_argv(optarg);
+			break;
+		case 'm':
+			cfg.mmap = 1;
+			break;
+		case 'l':
+			cfg.lazy = 1;
+			break;
+		case 'j':
+			cfg.journal = get_argv(optarg);
+			break;
+		case 't':
+			cfg.trace = optarg;
+			break;
+		default:
+			usage(program);
+		}
+	}
+
+	if (argc - optind != 2)
+		usage(program);
+	cfg.diskname = argv[optind + 1];
+
+	for (i = 0; i < ARRAY_SIZE(workloads); i++) {
+		if (!strcmp(argv[optind], workloads[i].name)) {
+			workloads[i].func(&cfg);
+			break;
+		}
+	}
+	if (i == ARRAY_SIZE(workloads)) {
+		bench_fs_error("invalid workload '%s'", argv[optind]);
+		usage(program);
+	}
+
+	return 0;
+}
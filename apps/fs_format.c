@@ -0,0 +1,77 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fs.h>
+
+#define fs_format_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	fs_format_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+#define die_perror(msg)			\
+do {							\
+	perror(msg);				\
+	exit(1);					\
+} while (0)
+
+void usage(char *program)
+{
+	fprintf(stderr, "Usage: %s [options] <diskname> <data block count>\n", program);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "\t-b <bytes>\tblock size, a power of two from 4096 to 65536 (default: 4096)\n");
+	fprintf(stderr, "\t-f <files>\tfiles the root directory can hold, rounded up to whole blocks\n"
+		"\t\t\t(default: %d)\n", FS_FILE_MAX_COUNT);
+	fprintf(stderr, "Creates a disk in the extended format, with 32-bit FAT entries. Disks in the\n"
+		"original format are created with fs_make.x.\n");
+	exit(1);
+}
+
+size_t get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX)
+		die_perror("strtol");
+	if (ret < 0)
+		die("Invalid number '%s'", argv);
+	return (size_t)ret;
+}
+
+int main(int argc, char **argv)
+{
+	char *program = argv[0];
+	size_t block_size = 4096;
+	size_t file_count = FS_FILE_MAX_COUNT;
+	size_t data_blk_count;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:f:")) != -1) {
+		switch (opt) {
+		case 'b':
+			block_size = get_argv(optarg);
+			break;
+		case 'f':
+			file_count = get_argv(optarg);
+			break;
+		default:
+			usage(program);
+		}
+	}
+
+	if (argc - optind != 2)
+		usage(program);
+	data_blk_count = get_argv(argv[optind + 1]);
+
+	if (fs_format(argv[optind], data_blk_count, block_size, file_count))
+		die("Cannot format '%s' with %zu blocks of %zu bytes for %zu files",
+		    argv[optind], data_blk_count, block_size, file_count);
+	printf("Created virtual disk '%s' with %zu data blocks of %zu bytes for %zu files\n",
+	       argv[optind], data_blk_count, block_size, file_count);
+
+	return 0;
+}
@@ -34,6 +34,44 @@ struct thread_arg {
 	char **argv;
 };
 
+/* Largest number of buffers a vectored script command is split into */
+#define SCRIPT_IOV_MAX 64
+
+/*
+ * Split @buf into buffers of 1, 2, 4... bytes up to 8 KiB and back to 1, so
+ * that they start and end at various places within blocks. The last buffer
+ * gets whatever is left.
+ */
+int split_iov(struct iovec *iov, char *buf, size_t len)
+{
+	size_t piece;
+	int n = 0;
+
+	while (len && n < SCRIPT_IOV_MAX - 1) {
+		piece = (size_t)1 << (n % 14);
+		if (piece > len)
+			piece = len;
+		iov[n].iov_base = buf;
+		iov[n].iov_len = piece;
+		buf += piece;
+		len -= piece;
+		n++;
+	}
+	if (len || !n) {
+		iov[n].iov_base = buf;
+		iov[n].iov_len = len;
+		n++;
+	}
+	return n;
+}
+
+/* Record the result of an asynchronous script command */
+void script_callback(int fd, int ret, void *arg)
+{
+	(void)fd;
+	*(int *)arg = ret;
+}
+
 void thread_fs_script(void *arg)
 {
 	struct thread_arg *t_arg = arg;
@@ -41,9 +79,10 @@ void thread_fs_script(void *arg)
 	char *diskname, *script;
 	FILE *fd_script;
 	char *command, *data_source, *data_description, *data, *fs_filename;
-	const int total_command_parts = 4;
-	char *command_args[total_command_parts];
-	int offset;
+	const int total_command_parts = 5;
+	char *command_args[total_command_parts + 1];
+	struct iovec iov[SCRIPT_IOV_MAX];
+	int offset = 0, arg_index;
 	char mounted = 0;
 
 	char line_buffer[1024];
@@ -94,6 +133,18 @@ void thread_fs_script(void *arg)
 				mounted = 1;
 			}
 
+		} else if (strcmp(command, "JOURNAL") == 0) {
+			if (fs_set_journal_size(atoi(command_args[1])))
+				die("Cannot set journal size");
+
+			printf("JOURNAL successful.\n");
+
+		} else if (strcmp(command, "CRASH") == 0) {
+			/* Leave without unmounting, as if the process was killed */
+			printf("CRASH without unmounting.\n");
+			fflush(stdout);
+			_exit(0);
+
 		} else if (strcmp(command, "UMOUNT") == 0) {
 			if (mounted && fs_umount())
 				die("Cannot unmount");
@@ -152,9 +203,59 @@ void thread_fs_script(void *arg)
 				printf("SEEK successful.\n");
 			}
 
-		} else if (strcmp(command, "WRITE") == 0) {
-			data_source = command_args[1];
-			data_description = command_args[2];
+		} else if (strcmp(command, "STAT") == 0) {
+			count = fs_stat(fs_fd);
+			if (count < 0) {
+				fs_umount();
+				die("Cannot stat file");
+			}
+
+			printf("Size of file is %d bytes.\n", count);
+
+		} else if (strcmp(command, "TRUNCATE") == 0) {
+			if (fs_truncate(fs_fd, atoi(command_args[1]))) {
+				fs_umount();
+				die("Cannot truncate file");
+			}
+
+			printf("TRUNCATE successful.\n");
+
+		} else if (strcmp(command, "FALLOCATE") == 0) {
+			if (fs_fallocate(fs_fd, atoi(command_args[1]))) {
+				fs_umount();
+				die("Cannot preallocate file");
+			}
+
+			printf("FALLOCATE successful.\n");
+
+		} else if (strcmp(command, "SYNC") == 0) {
+			if (fs_sync()) {
+				fs_umount();
+				die("Cannot sync");
+			}
+
+			printf("SYNC successful.\n");
+
+		} else if (strcmp(command, "CACHE") == 0) {
+			struct fs_cache_stats cs;
+
+			if (fs_cache_stats(&cs)) {
+				fs_umount();
+				die("Cannot get cache statistics");
+			}
+
+			printf("CACHE read ahead %zu blocks.\n", cs.prefetches);
+
+		} else if (strcmp(command, "WRITE") == 0 ||
+				   strcmp(command, "WRITEV") == 0 ||
+				   strcmp(command, "PWRITE") == 0 ||
+				   strcmp(command, "WRITE_ASYNC") == 0) {
+			/* PWRITE	<offset>	<source>	<description> */
+			arg_index = 1;
+			if (strcmp(command, "PWRITE") == 0)
+				offset = atoi(command_args[arg_index++]);
+			data_source = command_args[arg_index];
+			data_description = command_args[arg_index + 1];
 
 			if (strcmp(data_source, "DATA") == 0) {
 				data = data_description;
@@ -185,17 +286,34 @@ void thread_fs_script(void *arg)
 				die_perror("Could not find data to write");
 			}
 
-			count = fs_write(fs_fd, data, data_size);
+			if (strcmp(command, "WRITEV") == 0) {
+				count = fs_writev(fs_fd, iov, split_iov(iov, data, data_size));
+			} else if (strcmp(command, "PWRITE") == 0) {
+				count = fs_pwrite(fs_fd, data, data_size, offset);
+			} else if (strcmp(command, "WRITE_ASYNC") == 0) {
+				if (fs_write_async(fs_fd, data, data_size, script_callback,
+								   &count) || fs_async_wait())
+					count = -1;
+			} else {
+				count = fs_write(fs_fd, data, data_size);
+			}
 			if (count < 0) {
 				fs_umount();
 				die("write error");
 			}
 			printf("Wrote %d bytes to file.\n", count);
 
-		} else if (strcmp(command, "READ") == 0) {
+		} else if (strcmp(command, "READ") == 0 ||
+				   strcmp(command, "READV") == 0 ||
+				   strcmp(command, "PREAD") == 0 ||
+				   strcmp(command, "READ_ASYNC") == 0) {
+			/* PREAD	<length>	<offset>	<source>	<description> */
 			int read_req_length = atoi(command_args[1]);
-			data_source = command_args[2];
-			data_description = command_args[3];
+			arg_index = 2;
+			if (strcmp(command, "PREAD") == 0)
+				offset = atoi(command_args[arg_index++]);
+			data_source = command_args[arg_index];
+			data_description = command_args[arg_index + 1];
 
 			char file_loaded = 0;
 
@@ -240,7 +358,18 @@ void thread_fs_script(void *arg)
 			}
 
 			read_buf = calloc(read_req_length+1, sizeof(char));
-			count = fs_read(fs_fd, read_buf, read_req_length);
+			if (strcmp(command, "READV") == 0) {
+				count = fs_readv(fs_fd, iov,
+								 split_iov(iov, read_buf, read_req_length));
+			} else if (strcmp(command, "PREAD") == 0) {
+				count = fs_pread(fs_fd, read_buf, read_req_length, offset);
+			} else if (strcmp(command, "READ_ASYNC") == 0) {
+				if (fs_read_async(fs_fd, read_buf, read_req_length,
+								  script_callback, &count) || fs_async_wait())
+					count = -1;
+			} else {
+				count = fs_read(fs_fd, read_buf, read_req_length);
+			}
 
 			if (count < 0) {
 				fs_umount();
@@ -461,6 +590,63 @@ void thread_fs_add(void *arg)
 	close(fd);
 }
 
+void thread_fs_copy(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *src_diskname, *dst_diskname, *filename, *buf;
+	fs_t *src, *dst;
+	int src_fd, dst_fd;
+	int size, read, written;
+
+	if (t_arg->argc < 3)
+		die("Usage: <source diskname> <destination diskname> <filename>");
+
+	src_diskname = t_arg->argv[0];
+	dst_diskname = t_arg->argv[1];
+	filename = t_arg->argv[2];
+
+	/* Both file systems are mounted at the same time */
+	src = fs_mount_h(src_diskname);
+	if (!src)
+		die("Cannot mount source diskname");
+	dst = fs_mount_h(dst_diskname);
+	if (!dst) {
+		fs_umount_h(src);
+		die("Cannot mount destination diskname");
+	}
+
+	src_fd = fs_open_h(src, filename);
+	if (src_fd < 0 || fs_create_h(dst, filename)) {
+		fs_umount_h(dst);
+		fs_umount_h(src);
+		die("Cannot open source file or create destination file");
+	}
+	dst_fd = fs_open_h(dst, filename);
+	size = fs_stat_h(src, src_fd);
+	buf = malloc(size > 0 ? size : 1);
+	if (dst_fd < 0 || size < 0 || !buf) {
+		fs_umount_h(dst);
+		fs_umount_h(src);
+		die("Cannot open destination file");
+	}
+
+	read = fs_read_h(src, src_fd, buf, size);
+	written = fs_write_h(dst, dst_fd, buf, read > 0 ? read : 0);
+
+	if (fs_close_h(src, src_fd) || fs_close_h(dst, dst_fd)) {
+		fs_umount_h(dst);
+		fs_umount_h(src);
+		die("Cannot close file");
+	}
+
+	if (fs_umount_h(dst) || fs_umount_h(src))
+		die("Cannot unmount diskname");
+
+	printf("Copied file '%s' (%d/%d bytes)\n", filename, written, size);
+
+	free(buf);
+}
+
 void thread_fs_ls(void *arg)
 {
 	struct thread_arg *t_arg = arg;
@@ -507,6 +693,9 @@ size_t get_argv(char *argv)
 	return (size_t)ret;
 }
 
+/* Runs one of the commands below */
+void thread_fs_stats(void *arg);
+
 static struct {
 	const char *name;
 	void(*func)(void *);
@@ -516,10 +705,88 @@ static struct {
 	{ "add",	thread_fs_add },
 	{ "rm",		thread_fs_rm },
 	{ "cat",	thread_fs_cat },
+	{ "copy",	thread_fs_copy },
 	{ "stat",	thread_fs_stat },
-	{ "script",	thread_fs_script }
+	{ "script",	thread_fs_script },
+	{ "stats",	thread_fs_stats }
 };
 
+/* Format a duration given in nanoseconds with a readable unit */
+void format_ns(char *buf, size_t len, size_t ns)
+{
+	if (ns < 1000)
+		snprintf(buf, len, "%zuns", ns);
+	else if (ns < 1000000)
+		snprintf(buf, len, "%.1fus", ns / 1e3);
+	else if (ns < 1000000000)
+		snprintf(buf, len, "%.1fms", ns / 1e6);
+	else
+		snprintf(buf, len, "%.1fs", ns / 1e9);
+}
+
+void print_stats(struct fs_stats *stats)
+{
+	struct fs_op_stats *op;
+	char low[16], high[16];
+	int i, b;
+
+	printf("%-13s %8s %12s %8s %8s %10s\n", "op", "calls", "bytes",
+		   "blk_rd", "blk_wr", "avg");
+	for (i = 0; i < FS_OP_COUNT; i++) {
+		op = &stats->ops[i];
+		if (!op->calls)
+			continue;
+
+		format_ns(low, sizeof(low), op->total_ns / op->calls);
+		printf("%-13s %8zu %12zu %8zu %8zu %10s\n", fs_stats_name(i),
+			   op->calls, op->bytes, op->blocks_read, op->blocks_written,
+			   low);
+
+		/* Log-scale latency histogram, empty buckets omitted */
+		for (b = 0; b < FS_STATS_BUCKETS; b++) {
+			if (!op->latency[b])
+				continue;
+			format_ns(low, sizeof(low), b ? (size_t)1 << b : 0);
+			if (b == FS_STATS_BUCKETS - 1)
+				strcpy(high, "inf");
+			else
+				format_ns(high, sizeof(high), (size_t)1 << (b + 1));
+			printf("\t[%s, %s) %zu\n", low, high, op->latency[b]);
+		}
+	}
+}
+
+void thread_fs_stats(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	struct thread_arg cmd_arg;
+	struct fs_stats stats;
+	size_t i;
+
+	if (t_arg->argc < 1)
+		die("Usage: <command> [<arg>]");
+
+	/* Only count what the command does */
+	if (fs_stats_reset())
+		die("libfs built without statistics, rebuild it with make STATS=1");
+
+	cmd_arg.argc = t_arg->argc - 1;
+	cmd_arg.argv = &t_arg->argv[1];
+	for (i = 0; i < ARRAY_SIZE(commands); i++) {
+		if (commands[i].func != thread_fs_stats &&
+			!strcmp(t_arg->argv[0], commands[i].name)) {
+			commands[i].func(&cmd_arg);
+			break;
+		}
+	}
+	if (i == ARRAY_SIZE(commands))
+		die("invalid command '%s'", t_arg->argv[0]);
+
+	if (fs_stats(&stats))
+		die("Cannot get statistics");
+	print_stats(&stats);
+}
+
 void usage(char *program)
 {
 	size_t i;
@@ -244,6 +244,371 @@ END_SCRIPT
     log "Score: ${score}"
 }
 
+#
+# Extensions
+#
+
+# sync an open file, then crash without unmounting
+sync_crash() {
+    log "\n--- Running ${FUNCNAME} ---"
+
+	run_tool ./fs_make.x test.fs 10
+    cat <<END_SCRIPT > sync.script
+MOUNT
+CREATE	test-file-1
+OPEN	test-file-1
+WRITE	DATA	hello world
+SYNC
+CRASH
+END_SCRIPT
+    run_tool ./test_fs.x script test.fs sync.script
+    run_test ./fs_ref.x cat test.fs test-file-1
+
+	rm -f test.fs sync.script
+
+	local line_array=()
+	line_array+=("$(select_line "${STDOUT}" "1")")
+	line_array+=("$(select_line "${STDOUT}" "3")")
+	local corr_array=()
+	corr_array+=("Read file 'test-file-1' (11/11 bytes)")
+	corr_array+=("hello world")
+
+    local score
+    compare_lines line_array[@] corr_array[@] score
+    log "Score: ${score}"
+}
+
+# copy a file between two file systems mounted at once
+handle_copy() {
+    log "\n--- Running ${FUNCNAME} ---"
+
+	run_tool ./fs_make.x test.fs 100
+	run_tool ./fs_make.x test2.fs 100
+	run_tool dd if=/dev/urandom of=test-file-1 bs=1000 count=10
+	run_tool touch test-file-2
+	run_tool ./fs_ref.x add test.fs test-file-1
+	run_tool ./fs_ref.x add test2.fs test-file-2
+    cat <<END_SCRIPT > copy.script
+MOUNT
+OPEN	test-file-1
+READ	10000	FILE	test-file-1
+CLOSE
+UMOUNT
+END_SCRIPT
+	run_test ./test_fs.x copy test.fs test2.fs test-file-1
+	local copy_out="${STDOUT}"
+	run_test ./fs_ref.x ls test.fs
+	local src_out="${STDOUT}"
+	run_test ./test_fs.x script test2.fs copy.script
+	local read_out="${STDOUT}"
+	run_test ./fs_ref.x ls test2.fs
+
+	rm -f test.fs test2.fs test-file-1 test-file-2 copy.script
+
+	local line_array=()
+	line_array+=("$(select_line "${copy_out}" "1")")
+	line_array+=("$(select_line "${src_out}" "2")")
+	line_array+=("$(echo "${src_out}" | wc -l)")
+	line_array+=("$(select_line "${read_out}" "3")")
+	line_array+=("$(select_line "${STDOUT}" "2")")
+	line_array+=("$(select_line "${STDOUT}" "3")")
+	local corr_array=()
+	corr_array+=("Copied file 'test-file-1' (10000/10000 bytes)")
+	corr_array+=("file: test-file-1, size: 10000, data_blk: 1")
+	corr_array+=("2")
+	corr_array+=("Read 10000 bytes from file. Compared 10000 correct.")
+	corr_array+=("file: test-file-2, size: 0, data_blk: 65535")
+	corr_array+=("file: test-file-1, size: 10000, data_blk: 1")
+
+    local score
+    compare_lines line_array[@] corr_array[@] score
+    log "Score: ${score}"
+}
+
+# asynchronous write then read
+async_io() {
+    log "\n--- Running ${FUNCNAME} ---"
+
+	run_tool ./fs_make.x test.fs 100
+	run_tool dd if=/dev/urandom of=test-file-1 bs=1000 count=30
+    cat <<END_SCRIPT > async.script
+MOUNT
+CREATE	test-file-1
+OPEN	test-file-1
+WRITE_ASYNC	FILE	test-file-1
+SEEK	0
+READ_ASYNC	30000	FILE	test-file-1
+CLOSE
+UMOUNT
+END_SCRIPT
+    run_test ./test_fs.x script test.fs async.script
+
+	rm -f test.fs test-file-1 async.script
+
+	local line_array=()
+	line_array+=("$(select_line "${STDOUT}" "4")")
+	line_array+=("$(select_line "${STDOUT}" "6")")
+	local corr_array=()
+	corr_array+=("Wrote 30000 bytes to file.")
+	corr_array+=("Read 30000 bytes from file. Compared 30000 correct.")
+
+    local score
+    compare_lines line_array[@] corr_array[@] score
+    log "Score: ${score}"
+}
+
+# read a file one block at a time, the following blocks are read ahead
+readahead() {
+    log "\n--- Running ${FUNCNAME} ---"
+
+	run_tool ./fs_make.x test.fs 100
+	run_tool dd if=/dev/urandom of=test-file-1 bs=4096 count=16
+	run_tool ./fs_ref.x add test.fs test-file-1
+	split -b 4096 -d test-file-1 test-chunk-
+	{
+		printf 'MOUNT\nOPEN\ttest-file-1\n'
+		for chunk in test-chunk-*; do
+			printf 'READ\t4096\tFILE\t%s\n' "${chunk}"
+		done
+		printf 'CACHE\nCLOSE\nUMOUNT\n'
+	} > readahead.script
+    run_test ./test_fs.x script test.fs readahead.script
+
+	rm -f test.fs test-file-1 test-chunk-* readahead.script
+
+	local line_array=()
+	line_array+=("$(select_line "${STDOUT}" "3")")
+	line_array+=("$(select_line "${STDOUT}" "18")")
+	line_array+=("$(select_line "${STDOUT}" "19")")
+	local corr_array=()
+	corr_array+=("Read 4096 bytes from file. Compared 4096 correct.")
+	corr_array+=("Read 4096 bytes from file. Compared 4096 correct.")
+	corr_array+=("CACHE read ahead 15 blocks.")
+
+    local score
+    compare_lines line_array[@] corr_array[@] score
+    log "Score: ${score}"
+}
+
+# vectored and positioned reads and writes
+vector_io() {
+    log "\n--- Running ${FUNCNAME} ---"
+
+	run_tool ./fs_make.x test.fs 100
+	run_tool dd if=/dev/urandom of=test-file-1 bs=1000 count=30
+	head -c 5000 test-file-1 > test-file-2
+	{ head -c 5000 test-file-1; printf xyz; tail -c +5004 test-file-1; } > test-file-3
+    cat <<END_SCRIPT > vector.script
+MOUNT
+CREATE	test-file-1
+OPEN	test-file-1
+WRITEV	FILE	test-file-1
+SEEK	0
+READV	30000	FILE	test-file-1
+PWRITE	5000	DATA	xyz
+PREAD	3	5000	DATA	xyz
+PREAD	5000	0	FILE	test-file-2
+SEEK	0
+READV	30000	FILE	test-file-3
+CLOSE
+UMOUNT
+END_SCRIPT
+    run_test ./test_fs.x script test.fs vector.script
+
+	rm -f test.fs test-file-1 test-file-2 test-file-3 vector.script
+
+	local line_array=()
+	line_array+=("$(select_line "${STDOUT}" "4")")
+	line_array+=("$(select_line "${STDOUT}" "6")")
+	line_array+=("$(select_line "${STDOUT}" "7")")
+	line_array+=("$(select_line "${STDOUT}" "8")")
+	line_array+=("$(select_line "${STDOUT}" "9")")
+	line_array+=("$(select_line "${STDOUT}" "11")")
+	local corr_array=()
+	corr_array+=("Wrote 30000 bytes to file.")
+	corr_array+=("Read 30000 bytes from file. Compared 30000 correct.")
+	corr_array+=("Wrote 3 bytes to file.")
+	corr_array+=("Read 3 bytes from file. Compared 3 correct.")
+	corr_array+=("Read 5000 bytes from file. Compared 5000 correct.")
+	corr_array+=("Read 30000 bytes from file. Compared 30000 correct.")
+
+    local score
+    compare_lines line_array[@] corr_array[@] score
+    log "Score: ${score}"
+}
+
+# crash after a journal commit, the next mount replays it
+journal_replay() {
+    log "\n--- Running ${FUNCNAME} ---"
+
+	run_tool ./fs_make.x test.fs 100
+    cat <<END_SCRIPT > journal.script
+JOURNAL	8
+MOUNT
+CREATE	test-file-1
+OPEN	test-file-1
+WRITE	DATA	hello journal
+CLOSE
+CRASH
+END_SCRIPT
+    run_tool ./test_fs.x script test.fs journal.script
+    # the update is only in the journal, which fs_ref.x ignores
+    run_test ./fs_ref.x ls test.fs
+    local before_out="${STDOUT}"
+    run_test ./test_fs.x cat test.fs test-file-1
+    local cat_out="${STDOUT}"
+    run_test ./fs_ref.x ls test.fs
+
+	rm -f test.fs journal.script
+
+	local line_array=()
+	line_array+=("$(echo "${before_out}" | wc -l)")
+	line_array+=("$(select_line "${cat_out}" "1")")
+	line_array+=("$(select_line "${cat_out}" "3")")
+	line_array+=("$(select_line "${STDOUT}" "2")")
+	local corr_array=()
+	corr_array+=("1")
+	corr_array+=("Read file 'test-file-1' (13/13 bytes)")
+	corr_array+=("hello journal")
+	corr_array+=("file: test-file-1, size: 13, data_blk: 9")
+
+    local score
+    compare_lines line_array[@] corr_array[@] score
+    log "Score: ${score}"
+}
+
+# round trip of a file on a disk of 64 KiB blocks
+large_blocks() {
+    log "\n--- Running ${FUNCNAME} ---"
+
+	run_tool ./fs_format.x -b 65536 test.fs 64
+	run_tool dd if=/dev/urandom of=test-file-1 bs=1000 count=100
+    cat <<END_SCRIPT > large.script
+MOUNT
+CREATE	test-file-1
+OPEN	test-file-1
+WRITE	FILE	test-file-1
+CLOSE
+UMOUNT
+MOUNT
+OPEN	test-file-1
+READ	100000	FILE	test-file-1
+CLOSE
+UMOUNT
+END_SCRIPT
+	run_test ./test_fs.x script test.fs large.script
+	local script_out="${STDOUT}"
+	run_test ./test_fs.x info test.fs
+
+	rm -f test.fs test-file-1 large.script
+
+	local line_array=()
+	line_array+=("$(select_line "${script_out}" "9")")
+	line_array+=("$(select_line "${STDOUT}" "6")")
+	line_array+=("$(select_line "${STDOUT}" "7")")
+	local corr_array=()
+	corr_array+=("Read 100000 bytes from file. Compared 100000 correct.")
+	corr_array+=("data_blk_count=64")
+	corr_array+=("fat_free_ratio=61/64")
+
+    local score
+    compare_lines line_array[@] corr_array[@] score
+    log "Score: ${score}"
+}
+
+# more than 128 files on a disk of 64 KiB blocks, with a two-block root
+extended_format() {
+    log "\n--- Running ${FUNCNAME} ---"
+
+	run_tool ./fs_format.x -b 65536 -f 4096 test.fs 64
+	run_tool dd if=/dev/urandom of=test-file-1 bs=1000 count=100
+	{
+		printf 'MOUNT\n'
+		for i in $(seq 1 300); do
+			printf 'CREATE\tfile-%d\n' "${i}"
+		done
+		printf 'OPEN\tfile-300\nWRITE\tFILE\ttest-file-1\nCLOSE\nUMOUNT\n'
+		printf 'MOUNT\nOPEN\tfile-300\nREAD\t100000\tFILE\ttest-file-1\n'
+		printf 'CLOSE\nUMOUNT\n'
+	} > format.script
+	run_test ./test_fs.x script test.fs format.script
+	local script_out="${STDOUT}"
+	run_test ./test_fs.x info test.fs
+	local info_out="${STDOUT}"
+	run_test ./test_fs.x ls test.fs
+
+	rm -f test.fs test-file-1 format.script
+
+	local line_array=()
+	line_array+=("$(select_line "${script_out}" "308")")
+	line_array+=("$(select_line "${info_out}" "4")")
+	line_array+=("$(select_line "${info_out}" "5")")
+	line_array+=("$(select_line "${info_out}" "8")")
+	line_array+=("$(echo "${STDOUT}" | wc -l)")
+	local corr_array=()
+	corr_array+=("Read 100000 bytes from file. Compared 100000 correct.")
+	corr_array+=("rdir_blk=2")
+	corr_array+=("data_blk=4")
+	corr_array+=("rdir_free_ratio=3796/4096")
+	corr_array+=("301")
+
+    local score
+    compare_lines line_array[@] corr_array[@] score
+    log "Score: ${score}"
+}
+
+# truncate and preallocate a file, checking its size and blocks
+truncate_fallocate() {
+    log "\n--- Running ${FUNCNAME} ---"
+
+	run_tool ./fs_make.x test.fs 100
+	run_tool dd if=/dev/zero of=zero-file bs=4989 count=1
+    cat <<END_SCRIPT > truncate.script
+MOUNT
+CREATE	test-file-1
+OPEN	test-file-1
+WRITE	DATA	hello world
+FALLOCATE	20000
+STAT
+TRUNCATE	5000
+STAT
+PREAD	5	0	DATA	hello
+PREAD	4989	11	FILE	zero-file
+TRUNCATE	3
+STAT
+CLOSE
+UMOUNT
+END_SCRIPT
+    run_test ./test_fs.x script test.fs truncate.script
+    local script_out="${STDOUT}"
+    run_test ./fs_ref.x info test.fs
+    local info_out="${STDOUT}"
+    run_test ./fs_ref.x ls test.fs
+
+	rm -f test.fs zero-file truncate.script
+
+	local line_array=()
+	line_array+=("$(select_line "${script_out}" "6")")
+	line_array+=("$(select_line "${script_out}" "8")")
+	line_array+=("$(select_line "${script_out}" "9")")
+	line_array+=("$(select_line "${script_out}" "10")")
+	line_array+=("$(select_line "${script_out}" "12")")
+	line_array+=("$(select_line "${info_out}" "7")")
+	line_array+=("$(select_line "${STDOUT}" "2")")
+	local corr_array=()
+	corr_array+=("Size of file is 11 bytes.")
+	corr_array+=("Size of file is 5000 bytes.")
+	corr_array+=("Read 5 bytes from file. Compared 5 correct.")
+	corr_array+=("Read 4989 bytes from file. Compared 4989 correct.")
+	corr_array+=("Size of file is 3 bytes.")
+	corr_array+=("fat_free_ratio=98/100")
+	corr_array+=("file: test-file-1, size: 3, data_blk: 1")
+
+    local score
+    compare_lines line_array[@] corr_array[@] score
+    log "Score: ${score}"
+}
+
 #
 # Run tests
 #
@@ -255,6 +620,16 @@ run_tests() {
 	create_simple
     # Phase 3 + 4
 	read_block
+	# Extensions
+	sync_crash
+	handle_copy
+	async_io
+	readahead
+	vector_io
+	journal_replay
+	large_blocks
+	extended_format
+	truncate_fallocate
 }
 
 make_fs() {
@@ -262,7 +637,7 @@ make_fs() {
     make > /dev/null 2>&1 ||
         die "Compilation failed"
 
-    local execs=("test_fs.x" "fs_make.x" "fs_ref.x")
+    local execs=("test_fs.x" "fs_make.x" "fs_ref.x" "fs_format.x")
 
     # Make sure executables were properly created
     local x
@@ -0,0 +1,290 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cache.h>
+#include <disk.h>
+#include <fs.h>
+
+#define trace_replay_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	trace_replay_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+#define die_perror(msg)			\
+do {							\
+	perror(msg);				\
+	exit(1);					\
+} while (0)
+
+/* Parameters of a replay, set from the command line */
+struct replay_config {
+	char *diskname;
+	char *tracename;
+	/* Issue every access as soon as the previous one completes */
+	int fast;
+	/* Size of the block cache the accesses go through, 0 for none */
+	size_t cache_size;
+	int mmap;
+};
+
+/* Counts of the replayed accesses */
+struct replay_counts {
+	size_t records;
+	size_t blocks_read;
+	size_t blocks_written;
+	size_t syncs;
+	/* Records made from each fs_*() operation, unknown ones last */
+	size_t ops[FS_OP_COUNT + 1];
+	/* Time of the last record, in nanoseconds */
+	unsigned long long trace_ns;
+	/* Largest delay of an access behind its original time */
+	unsigned long long late_ns;
+};
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_ns(long long ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000;
+	ts.tv_nsec = ns % 1000000000;
+	while (nanosleep(&ts, &ts))
+		;
+}
+
+static FILE *trace_open(struct replay_config *cfg, disk_t *disk)
+{
+	struct disk_trace_header header;
+	FILE *trace;
+
+	trace = fopen(cfg->tracename, "r");
+	if (!trace)
+		die_perror("fopen");
+
+	if (fread(&header, sizeof(header), 1, trace) != 1)
+		die("Cannot read trace header");
+	if (header.magic != DISK_TRACE_MAGIC)
+		die("Not a block trace: %s", cfg->tracename);
+	if (header.version != DISK_TRACE_VERSION ||
+	    header.record_size != sizeof(struct disk_trace_record))
+		die("Unsupported trace version '%d'", header.version);
+	/* Access the disk with the blocks it was recorded with */
+	if (disk_set_block_size(disk, header.block_size))
+		die("Cannot use the %u-byte blocks of the trace",
+		    header.block_size);
+	if (header.block_count > (unsigned)disk_count(disk))
+		die("Trace recorded on a larger disk (%u blocks)",
+		    header.block_count);
+
+	return trace;
+}
+
+/*
+ * Replay one record. Single blocks go through the cache as fs.c accesses them,
+ * larger ranges as vectored transfers, and written data is the buffer's pattern.
+ */
+static void replay_record(cache_t *cache, disk_t *disk,
+			  struct disk_trace_record *rec, char *buf)
+{
+	int ret;
+
+	switch (rec->type) {
+	case DISK_TRACE_READ:
+		if (rec->count == 1)
+			ret = cache_read(cache, rec->block, buf);
+		else
+			ret = cache_readv(cache, rec->block, rec->count, buf);
+		if (ret)
+			die("Cannot read blocks %u-%u", rec->block,
+			    rec->block + rec->count - 1);
+		break;
+	case DISK_TRACE_WRITE:
+		if (rec->count == 1)
+			ret = cache_write(cache, rec->block, buf);
+		else
+			ret = cache_writev(cache, rec->block, rec->count, buf);
+		if (ret)
+			die("Cannot write blocks %u-%u", rec->block,
+			    rec->block + rec->count - 1);
+		break;
+	case DISK_TRACE_SYNC:
+		if (cache_flush(cache) || disk_sync(disk))
+			die("Cannot sync disk");
+		break;
+	default:
+		die("Invalid record type '%d'", rec->type);
+	}
+}
+
+static void report(struct replay_config *cfg, struct replay_counts *c,
+		   struct cache_stats *cs, size_t block_size, long long total_ns)
+{
+	double seconds = total_ns / 1e9;
+	const char *sep = "";
+	int i;
+
+	printf("{\"trace\":\"%s\",\"records\":%zu,\"blocks_read\":%zu,"
+	       "\"blocks_written\":%zu,\"syncs\":%zu,\"seconds\":%.6f,"
+	       "\"trace_seconds\":%.6f,\"late_seconds\":%.6f,"
+	       "\"mb_per_sec\":%.2f,\"cache\":%zu,\"hits\":%zu,\"misses\":%zu,"
+	       "\"evictions\":%zu,\"writebacks\":%zu,\"speed\":\"%s\","
+	       "\"backend\":\"%s\",\"ops\":{",
+	       cfg->tracename, c->records, c->blocks_read, c->blocks_written,
+	       c->syncs, seconds, c->trace_ns / 1e9, c->late_ns / 1e9,
+	       seconds > 0 ? (c->blocks_read + c->blocks_written) *
+	       (double)block_size / seconds / (1024 * 1024) : 0,
+	       cfg->cache_size, cs->hits, cs->misses, cs->evictions,
+	       cs->writebacks, cfg->fast ? "max" : "original",
+	       cfg->mmap ? "mmap" : "file");
+	for (i = 0; i <= FS_OP_COUNT; i++) {
+		if (!c->ops[i])
+			continue;
+		printf("%s\"%s\":%zu", sep,
+		       i < FS_OP_COUNT ? fs_stats_name(i) : "unknown", c->ops[i]);
+		sep = ",";
+	}
+	printf("}}\n");
+}
+
+static void replay(struct replay_config *cfg)
+{
+	struct replay_counts c = { 0 };
+	struct disk_trace_record rec;
+	struct cache_stats cs;
+	size_t buf_blocks = 0;
+	char *buf = NULL;
+	long long start, ahead;
+	cache_t *cache;
+	disk_t *disk;
+	FILE *trace;
+
+	disk = disk_open(cfg->diskname,
+			 cfg->mmap ? BLOCK_BACKEND_MMAP : BLOCK_BACKEND_FILE);
+	if (!disk)
+		die("Cannot open disk");
+	/* Before the cache, which takes the block size of the disk */
+	trace = trace_open(cfg, disk);
+	cache = cache_create(disk, cfg->cache_size);
+	if (!cache)
+		die("Cannot create cache");
+
+	start = now_ns();
+	while (fread(&rec, sizeof(rec), 1, trace) == 1) {
+		if (rec.block + rec.count > (unsigned)disk_count(disk))
+			die("Block %u out of the disk", rec.block);
+
+		/* Grow the buffer to the largest access so far */
+		if (rec.count > buf_blocks) {
+			free(buf);
+			buf_blocks = rec.count;
+			buf = malloc(buf_blocks * disk_block_size(disk));
+			if (!buf)
+				die_perror("malloc");
+			memset(buf, 0xA5, buf_blocks * disk_block_size(disk));
+		}
+
+		/* Wait for the time of the original access */
+		if (!cfg->fast) {
+			ahead = (long long)rec.time_ns - (now_ns() - start);
+			if (ahead > 0)
+				sleep_ns(ahead);
+			else if ((unsigned long long)-ahead > c.late_ns)
+				c.late_ns = -ahead;
+		}
+
+		replay_record(cache, disk, &rec, buf);
+
+		c.records++;
+		c.ops[rec.op < FS_OP_COUNT ? rec.op : FS_OP_COUNT]++;
+		c.trace_ns = rec.time_ns;
+		if (rec.type == DISK_TRACE_READ)
+			c.blocks_read += rec.count;
+		else if (rec.type == DISK_TRACE_WRITE)
+			c.blocks_written += rec.count;
+		else
+			c.syncs++;
+	}
+	if (ferror(trace))
+		die("Cannot read trace");
+
+	/* Dirty blocks left in the cache are part of the replay */
+	if (cache_flush(cache))
+		die("Cannot flush cache");
+	cache_get_stats(cache, &cs);
+	report(cfg, &c, &cs, disk_block_size(disk), now_ns() - start);
+
+	fclose(trace);
+	if (cache_destroy(cache) || disk_close(disk))
+		die("Cannot close disk");
+	free(buf);
+}
+
+void usage(char *program)
+{
+	fprintf(stderr, "Usage: %s [options] <diskname> <trace>\n", program);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "\t-f\t\treplay as fast as possible (default: original timing)\n");
+	fprintf(stderr, "\t-c <blocks>\treplay through a block cache (default: 0, no cache)\n");
+	fprintf(stderr, "\t-m\t\tmemory-map the disk\n");
+	fprintf(stderr, "Traces are recorded with fs_set_trace() or bench_fs.x -t. Written blocks are\n"
+		"filled with a pattern, so the disk should be a scratch copy. Results are\n"
+		"printed as a JSON object.\n");
+	exit(1);
+}
+
+size_t get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+	if (ret == LONG_MIN || ret == LONG_MAX)
+		die_perror("strtol");
+	if (ret < 0)
+		die("Invalid number '%s'", argv);
+	return (size_t)ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct replay_config cfg = { 0 };
+	char *program = argv[0];
+	int opt;
+
+	while ((opt = getopt(argc, argv, "fc:m")) != -1) {
+		switch (opt) {
+		case 'f':
+			cfg.fast = 1;
+			break;
+		case 'c':
+			cfg.cache_size = get_argv(optarg);
+			break;
+		case 'm':
+			cfg.mmap = 1;
+			break;
+		default:
+			usage(program);
+		}
+	}
+
+	if (argc - optind != 2)
+		usage(program);
+	cfg.diskname = argv[optind];
+	cfg.tracename = argv[optind + 1];
+
+	replay(&cfg);
+
+	return 0;
+}
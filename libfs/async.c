@@ -0,0 +1,229 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "async.h"
+
+#define async_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+/* Key of a worker that is not running any job */
+#define NO_KEY -1
+
+/* Queued job */
+struct job {
+	/* Ordering key */
+	int key;
+	/* Function to run, and its argument */
+	void (*fn)(void *arg);
+	void *arg;
+	/* Next job in the queue */
+	struct job *next;
+};
+
+/* Worker thread description */
+struct worker {
+	/* Pool the worker belongs to */
+	struct async *async;
+	pthread_t thread;
+	/* Key of the job being run, %NO_KEY if idle */
+	int key;
+};
+
+/* Pool of worker threads */
+struct async {
+	/* Protects everything below */
+	pthread_mutex_t lock;
+	/* Signaled when a job may be runnable, or when workers must stop */
+	pthread_cond_t work;
+	/* Signaled when a job completes */
+	pthread_cond_t done;
+	/* Queue of jobs not started yet, in submission order */
+	struct job *head;
+	struct job **tail;
+	/* Number of jobs queued or running */
+	size_t pending;
+	/* Workers */
+	struct worker *workers;
+	unsigned nthreads;
+	/* Number of workers started */
+	unsigned started;
+	/* Workers must exit once the queue is empty */
+	int stopping;
+};
+
+static int key_running(struct async *async, int key)
+{
+	unsigned i;
+
+	for (i = 0; i < async->started; i++) {
+		if (async->workers[i].key == key)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Unlink the first queued job whose key is not already running */
+static struct job *take_job(struct async *async)
+{
+	struct job **p, *job;
+
+	for (p = &async->head; *p; p = &(*p)->next) {
+		if (key_running(async, (*p)->key))
+			continue;
+
+		job = *p;
+		*p = job->next;
+		if (async->tail == &job->next)
+			async->tail = p;
+		return job;
+	}
+
+	return NULL;
+}
+
+static void *async_worker(void *arg)
+{
+	struct worker *worker = arg;
+	struct async *async = worker->async;
+	struct job *job;
+
+	pthread_mutex_lock(&async->lock);
+	for (;;) {
+		job = take_job(async);
+		if (!job) {
+			if (async->stopping && !async->head)
+				break;
+			pthread_cond_wait(&async->work, &async->lock);
+			continue;
+		}
+
+		worker->key = job->key;
+		pthread_mutex_unlock(&async->lock);
+		job->fn(job->arg);
+		free(job);
+		pthread_mutex_lock(&async->lock);
+		worker->key = NO_KEY;
+		async->pending--;
+
+		/* Jobs with the same key may run now */
+		pthread_cond_broadcast(&async->work);
+		pthread_cond_broadcast(&async->done);
+	}
+	pthread_mutex_unlock(&async->lock);
+
+	return NULL;
+}
+
+struct async *async_create(unsigned nthreads)
+{
+	struct async *async;
+
+	if (!nthreads) {
+		async_error("no worker thread");
+		return NULL;
+	}
+
+	async = calloc(1, sizeof(*async));
+	if (!async) {
+		perror("calloc");
+		return NULL;
+	}
+
+	async->workers = calloc(nthreads, sizeof(*async->workers));
+	if (!async->workers) {
+		perror("calloc");
+		free(async);
+		return NULL;
+	}
+
+	pthread_mutex_init(&async->lock, NULL);
+	pthread_cond_init(&async->work, NULL);
+	pthread_cond_init(&async->done, NULL);
+	async->tail = &async->head;
+	async->nthreads = nthreads;
+
+	return async;
+}
+
+void async_destroy(struct async *async)
+{
+	unsigned i;
+
+	if (!async)
+		return;
+
+	pthread_mutex_lock(&async->lock);
+	async->stopping = 1;
+	pthread_cond_broadcast(&async->work);
+	pthread_mutex_unlock(&async->lock);
+
+	for (i = 0; i < async->started; i++)
+		pthread_join(async->workers[i].thread, NULL);
+
+	pthread_cond_destroy(&async->done);
+	pthread_cond_destroy(&async->work);
+	pthread_mutex_destroy(&async->lock);
+	free(async->workers);
+	free(async);
+}
+
+int async_submit(struct async *async, int key, void (*fn)(void *arg),
+		 void *arg)
+{
+	struct worker *worker;
+	struct job *job;
+
+	if (key < 0) {
+		async_error("invalid key '%d'", key);
+		return -1;
+	}
+
+	job = malloc(sizeof(*job));
+	if (!job) {
+		perror("malloc");
+		return -1;
+	}
+	job->key = key;
+	job->fn = fn;
+	job->arg = arg;
+	job->next = NULL;
+
+	pthread_mutex_lock(&async->lock);
+
+	/* Start one more worker for each job, until all of them run */
+	if (async->started < async->nthreads &&
+	    async->started <= async->pending) {
+		worker = &async->workers[async->started];
+		worker->async = async;
+		worker->key = NO_KEY;
+		if (pthread_create(&worker->thread, NULL, async_worker, worker)) {
+			async_error("cannot start worker thread");
+		} else {
+			async->started++;
+		}
+	}
+
+	if (!async->started) {
+		pthread_mutex_unlock(&async->lock);
+		free(job);
+		return -1;
+	}
+
+	*async->tail = job;
+	async->tail = &job->next;
+	async->pending++;
+	pthread_cond_signal(&async->work);
+	pthread_mutex_unlock(&async->lock);
+
+	return 0;
+}
+
+void async_drain(struct async *async)
+{
+	pthread_mutex_lock(&async->lock);
+	while (async->pending)
+		pthread_cond_wait(&async->done, &async->lock);
+	pthread_mutex_unlock(&async->lock);
+}
@@ -0,0 +1,44 @@
+#ifndef _ASYNC_H
+#define _ASYNC_H
+
+/** Pool of worker threads running queued jobs */
+typedef struct async async_t;
+
+/**
+ * async_create - Create a pool of worker threads
+ * @nthreads: Number of worker threads
+ *
+ * Threads are only started when the first job is submitted.
+ *
+ * Return: NULL if memory cannot be allocated. Otherwise, the new pool.
+ */
+async_t *async_create(unsigned nthreads);
+
+/**
+ * async_destroy - Wait for every job, then stop and release a pool
+ * @async: Pool of worker threads
+ */
+void async_destroy(async_t *async);
+
+/**
+ * async_submit - Queue a job
+ * @async: Pool of worker threads
+ * @key: Ordering key of the job (non-negative)
+ * @fn: Function run by the job
+ * @arg: Argument given to @fn
+ *
+ * Queue a job that runs @fn(@arg) in one of the worker threads. Jobs with
+ * different keys run concurrently, while jobs sharing the same key run one at a
+ * time, in the order they were submitted.
+ *
+ * Return: -1 if @key is negative, or if the job cannot be queued. 0 otherwise.
+ */
+int async_submit(async_t *async, int key, void (*fn)(void *arg), void *arg);
+
+/**
+ * async_drain - Wait until every submitted job has completed
+ * @async: Pool of worker threads
+ */
+void async_drain(async_t *async);
+
+#endif /* _ASYNC_H */
@@ -0,0 +1,688 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "disk.h"
+
+#define cache_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+/* Empty hash chain or slot not holding any block */
+#define NO_SLOT -1
+/* Block cached by another thread while the lock was dropped */
+#define CACHED -2
+
+/*
+ * Vectored requests of more blocks than this share of the cache bypass it, so
+ * that large transfers do not evict the frequently accessed blocks
+ */
+#define CACHE_BYPASS_SHARE 4
+
+/* Cache slot description */
+struct slot {
+	/* Index of the block held in this slot */
+	size_t block;
+	/* Slot currently holds a block */
+	int valid;
+	/* Cached copy is newer than the one on disk */
+	int dirty;
+	/* Reference bit for the CLOCK algorithm */
+	int referenced;
+	/* Block is being read from or written to disk without the lock */
+	int busy;
+	/* Next slot in the same hash chain */
+	int next;
+};
+
+/* Block cache description */
+struct cache {
+	/* Disk whose blocks are cached */
+	struct disk *disk;
+	/* Size of the disk's blocks */
+	size_t block_size;
+	/* Number of slots */
+	size_t nslots;
+	/* Slot descriptions */
+	struct slot *slots;
+	/* Block data, one @block_size chunk per slot */
+	char *data;
+	/* Hash buckets (block index to first slot of the chain) */
+	int *buckets;
+	/* Number of buckets, always a power of two */
+	size_t nbuckets;
+	/* Position of the CLOCK hand */
+	size_t hand;
+	/* Counters */
+	struct cache_stats stats;
+	/*
+	 * Protects everything above, but is never held during disk transfers.
+	 * Slots being transferred are marked busy instead, and the threads that
+	 * need them wait for @idle.
+	 */
+	pthread_mutex_t lock;
+	pthread_cond_t idle;
+};
+
+static size_t cache_hash(struct cache *cache, size_t block)
+{
+	return (block * 2654435761u) & (cache->nbuckets - 1);
+}
+
+static void *slot_data(struct cache *cache, int s)
+{
+	return cache->data + (size_t)s * cache->block_size;
+}
+
+static int cache_lookup(struct cache *cache, size_t block)
+{
+	int s;
+
+	for (s = cache->buckets[cache_hash(cache, block)]; s != NO_SLOT;
+	     s = cache->slots[s].next) {
+		if (cache->slots[s].block == block)
+			return s;
+	}
+
+	return NO_SLOT;
+}
+
+/* Look a block up, waiting for its slot if it is busy */
+static int cache_lookup_idle(struct cache *cache, size_t block)
+{
+	int s;
+
+	while ((s = cache_lookup(cache, block)) != NO_SLOT &&
+	       cache->slots[s].busy)
+		pthread_cond_wait(&cache->idle, &cache->lock);
+
+	return s;
+}
+
+/* Let the threads waiting for a busy slot go on */
+static void slot_idle(struct cache *cache, int s)
+{
+	cache->slots[s].busy = 0;
+	pthread_cond_broadcast(&cache->idle);
+}
+
+static void cache_unlink(struct cache *cache, int s)
+{
+	int *p = &cache->buckets[cache_hash(cache, cache->slots[s].block)];
+
+	while (*p != s)
+		p = &cache->slots[*p].next;
+	*p = cache->slots[s].next;
+}
+
+/*
+ * Find a slot for a new block, evicting (and writing back) a victim if needed.
+ * The lock is dropped while the victim is written back.
+ */
+static int cache_victim(struct cache *cache)
+{
+	struct slot *slot;
+	size_t nbusy = 0;
+	int s, ret;
+
+	for (;;) {
+		s = cache->hand;
+		slot = &cache->slots[s];
+		cache->hand = (cache->hand + 1) % cache->nslots;
+
+		if (slot->busy) {
+			/* Every slot is being transferred, wait for one */
+			if (++nbusy == cache->nslots) {
+				pthread_cond_wait(&cache->idle, &cache->lock);
+				nbusy = 0;
+			}
+			continue;
+		}
+		nbusy = 0;
+
+		if (!slot->valid)
+			return s;
+
+		if (slot->referenced) {
+			slot->referenced = 0;
+			continue;
+		}
+
+		if (slot->dirty) {
+			slot->busy = 1;
+			pthread_mutex_unlock(&cache->lock);
+			ret = disk_write(cache->disk, slot->block,
+					 slot_data(cache, s));
+			pthread_mutex_lock(&cache->lock);
+			slot_idle(cache, s);
+			if (ret)
+				return NO_SLOT;
+			slot->dirty = 0;
+			cache->stats.writebacks++;
+
+			/* Accessed meanwhile, the block gets its second chance */
+			if (slot->referenced)
+				continue;
+		}
+
+		cache_unlink(cache, s);
+		slot->valid = 0;
+		slot->dirty = 0;
+		cache->stats.evictions++;
+		return s;
+	}
+}
+
+/*
+ * Insert a block that is not cached. Return CACHED if another thread inserted
+ * it while the lock was dropped to write a victim back.
+ */
+static int cache_insert(struct cache *cache, size_t block)
+{
+	size_t h;
+	int s;
+
+	s = cache_victim(cache);
+	if (s == NO_SLOT)
+		return NO_SLOT;
+	if (cache_lookup(cache, block) != NO_SLOT)
+		return CACHED;
+
+	h = cache_hash(cache, block);
+	cache->slots[s].block = block;
+	cache->slots[s].valid = 1;
+	cache->slots[s].dirty = 0;
+	cache->slots[s].referenced = 1;
+	cache->slots[s].next = cache->buckets[h];
+	cache->buckets[h] = s;
+
+	return s;
+}
+
+/* Find the slot of a block, inserting the block if it is not cached yet */
+static int cache_get(struct cache *cache, size_t block, int *hit)
+{
+	int s;
+
+	do {
+		s = cache_lookup_idle(cache, block);
+		if (s != NO_SLOT) {
+			cache->stats.hits++;
+			cache->slots[s].referenced = 1;
+			*hit = 1;
+			return s;
+		}
+		s = cache_insert(cache, block);
+	} while (s == CACHED);
+
+	cache->stats.misses++;
+	*hit = 0;
+	return s;
+}
+
+struct cache *cache_create(struct disk *disk, size_t nblocks)
+{
+	struct cache *cache;
+	size_t i;
+
+	if (!disk) {
+		cache_error("no disk to cache");
+		return NULL;
+	}
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache) {
+		perror("calloc");
+		return NULL;
+	}
+
+	pthread_mutex_init(&cache->lock, NULL);
+	pthread_cond_init(&cache->idle, NULL);
+	cache->disk = disk;
+	cache->block_size = disk_block_size(disk);
+	if (!nblocks)
+		return cache;
+
+	cache->nbuckets = 1;
+	while (cache->nbuckets < nblocks * 2)
+		cache->nbuckets <<= 1;
+
+	cache->slots = calloc(nblocks, sizeof(struct slot));
+	cache->data = malloc(nblocks * cache->block_size);
+	cache->buckets = malloc(cache->nbuckets * sizeof(int));
+	if (!cache->slots || !cache->data || !cache->buckets) {
+		perror("malloc");
+		free(cache->slots);
+		free(cache->data);
+		free(cache->buckets);
+		pthread_mutex_destroy(&cache->lock);
+		pthread_cond_destroy(&cache->idle);
+		free(cache);
+		return NULL;
+	}
+
+	for (i = 0; i < cache->nbuckets; i++)
+		cache->buckets[i] = NO_SLOT;
+	cache->nslots = nblocks;
+
+	return cache;
+}
+
+int cache_destroy(struct cache *cache)
+{
+	int ret;
+
+	if (!cache) {
+		cache_error("no cache");
+		return -1;
+	}
+
+	ret = cache_flush(cache);
+
+	free(cache->slots);
+	free(cache->data);
+	free(cache->buckets);
+	pthread_mutex_destroy(&cache->lock);
+	pthread_cond_destroy(&cache->idle);
+	free(cache);
+
+	return ret;
+}
+
+int cache_read(struct cache *cache, size_t block, void *buf)
+{
+	int s, hit, ret = 0;
+
+	if (!cache->nslots)
+		return disk_read(cache->disk, block, buf);
+
+	pthread_mutex_lock(&cache->lock);
+	s = cache_get(cache, block, &hit);
+	if (s == NO_SLOT) {
+		pthread_mutex_unlock(&cache->lock);
+		return disk_read(cache->disk, block, buf);
+	}
+
+	if (!hit) {
+		/* Lookups of the block wait until it is read */
+		cache->slots[s].busy = 1;
+		pthread_mutex_unlock(&cache->lock);
+		ret = disk_read(cache->disk, block, slot_data(cache, s));
+		pthread_mutex_lock(&cache->lock);
+		slot_idle(cache, s);
+		if (ret) {
+			cache_unlink(cache, s);
+			cache->slots[s].valid = 0;
+			goto out;
+		}
+	}
+	memcpy(buf, slot_data(cache, s), cache->block_size);
+
+out:
+	pthread_mutex_unlock(&cache->lock);
+	return ret;
+}
+
+int cache_write(struct cache *cache, size_t block, const void *buf)
+{
+	int s, hit;
+
+	if (!cache->nslots)
+		return disk_write(cache->disk, block, buf);
+
+	pthread_mutex_lock(&cache->lock);
+	s = cache_get(cache, block, &hit);
+	if (s == NO_SLOT) {
+		pthread_mutex_unlock(&cache->lock);
+		return disk_write(cache->disk, block, buf);
+	}
+
+	memcpy(slot_data(cache, s), buf, cache->block_size);
+	cache->slots[s].dirty = 1;
+	pthread_mutex_unlock(&cache->lock);
+
+	return 0;
+}
+
+/* Copy the cached blocks of a read request, and gather its missing runs */
+static int cache_submit_read(struct cache *cache,
+			     const struct disk_request *req,
+			     struct disk_request *todo)
+{
+	char *dst = req->buf;
+	size_t i, run;
+	int s, n = 0;
+
+	for (i = 0; i < req->count; i += run) {
+		s = cache_lookup_idle(cache, req->block + i);
+		if (s != NO_SLOT) {
+			cache->stats.hits++;
+			cache->slots[s].referenced = 1;
+			memcpy(dst + i * cache->block_size, slot_data(cache, s),
+			       cache->block_size);
+			run = 1;
+			continue;
+		}
+
+		for (run = 0; i + run < req->count &&
+		     cache_lookup(cache, req->block + i + run) == NO_SLOT; run++)
+			cache->stats.misses++;
+		todo[n].block = req->block + i;
+		todo[n].count = run;
+		todo[n].buf = dst + i * cache->block_size;
+		todo[n].is_write = 0;
+		n++;
+	}
+
+	return n;
+}
+
+/* Whether a vectored request is too large to go through the cache */
+static int cache_bypass(struct cache *cache, const struct disk_request *req)
+{
+	return req->count > cache->nslots / CACHE_BYPASS_SHARE;
+}
+
+/*
+ * Keep the blocks of a small write as dirty slots, without any disk access.
+ * Return 1 if a block could not get a slot, the whole range must then be
+ * written to disk.
+ */
+static int cache_submit_write_back(struct cache *cache,
+				   const struct disk_request *req)
+{
+	const char *src = req->buf;
+	size_t i;
+	int s, hit, uncached = 0;
+
+	for (i = 0; i < req->count; i++) {
+		s = cache_get(cache, req->block + i, &hit);
+		if (s == NO_SLOT) {
+			uncached = 1;
+			continue;
+		}
+		cache->slots[s].dirty = 1;
+		memcpy(slot_data(cache, s), src + i * cache->block_size,
+		       cache->block_size);
+	}
+
+	return uncached;
+}
+
+/* Insert the blocks of a small read that were missing, now that they are read */
+static void cache_submit_fill(struct cache *cache,
+			      const struct disk_request *req)
+{
+	const char *src = req->buf;
+	size_t i;
+	int s;
+
+	for (i = 0; i < req->count; i++) {
+		if (cache_lookup(cache, req->block + i) != NO_SLOT)
+			continue;
+		s = cache_insert(cache, req->block + i);
+		if (s == CACHED)
+			continue;
+		if (s == NO_SLOT)
+			return;
+		memcpy(slot_data(cache, s), src + i * cache->block_size,
+		       cache->block_size);
+	}
+}
+
+/*
+ * Keep cached copies of a large write in sync. They stay dirty until the range
+ * is written, so that a failed write is retried by later flushes.
+ */
+static void cache_submit_write(struct cache *cache,
+			       const struct disk_request *req)
+{
+	const char *src = req->buf;
+	size_t i;
+	int s;
+
+	for (i = 0; i < req->count; i++) {
+		s = cache_lookup_idle(cache, req->block + i);
+		if (s == NO_SLOT) {
+			cache->stats.misses++;
+			continue;
+		}
+		cache->stats.hits++;
+		cache->slots[s].referenced = 1;
+		cache->slots[s].dirty = 1;
+		memcpy(slot_data(cache, s), src + i * cache->block_size,
+		       cache->block_size);
+	}
+}
+
+/* Cached copies of a written range are clean, unless evicted meanwhile */
+static void cache_submit_clean(struct cache *cache,
+			       const struct disk_request *req)
+{
+	size_t i;
+	int s;
+
+	for (i = 0; i < req->count; i++) {
+		s = cache_lookup(cache, req->block + i);
+		if (s != NO_SLOT)
+			cache->slots[s].dirty = 0;
+	}
+}
+
+int cache_submit(struct cache *cache, const struct disk_request *reqs,
+		 int nreqs)
+{
+	struct disk_request local[16], *todo = local;
+	size_t max = 0;
+	int r, n = 0, ret;
+
+	if (!cache->nslots)
+		return disk_submit(cache->disk, reqs, nreqs);
+
+	/* A read has at most one run of missing blocks every two blocks */
+	for (r = 0; r < nreqs; r++)
+		max += reqs[r].is_write ? 1 : (reqs[r].count + 1) / 2;
+	if (max > sizeof(local) / sizeof(local[0])) {
+		todo = malloc(max * sizeof(*todo));
+		if (!todo) {
+			perror("malloc");
+			return -1;
+		}
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	for (r = 0; r < nreqs; r++) {
+		if (!reqs[r].is_write) {
+			n += cache_submit_read(cache, &reqs[r], todo + n);
+		} else if (cache_bypass(cache, &reqs[r])) {
+			cache_submit_write(cache, &reqs[r]);
+			todo[n++] = reqs[r];
+		} else if (cache_submit_write_back(cache, &reqs[r])) {
+			todo[n++] = reqs[r];
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	/*
+	 * Missing blocks are read, and written blocks written, without holding
+	 * the lock. Callers never read or write a block while it is being
+	 * written, so no newer copy of these blocks can show up meanwhile.
+	 */
+	ret = n ? disk_submit(cache->disk, todo, n) : 0;
+
+	if (!ret) {
+		pthread_mutex_lock(&cache->lock);
+		for (r = 0; r < n; r++) {
+			if (todo[r].is_write)
+				cache_submit_clean(cache, &todo[r]);
+		}
+		for (r = 0; r < nreqs; r++) {
+			if (!reqs[r].is_write && !cache_bypass(cache, &reqs[r]))
+				cache_submit_fill(cache, &reqs[r]);
+		}
+		pthread_mutex_unlock(&cache->lock);
+	}
+
+	if (todo != local)
+		free(todo);
+	return ret;
+}
+
+int cache_readv(struct cache *cache, size_t block, size_t count, void *buf)
+{
+	struct disk_request req = {
+		.block = block, .count = count, .buf = buf, .is_write = 0,
+	};
+
+	return cache_submit(cache, &req, 1);
+}
+
+int cache_writev(struct cache *cache, size_t block, size_t count,
+		 const void *buf)
+{
+	struct disk_request req = {
+		.block = block, .count = count, .buf = (void *)buf, .is_write = 1,
+	};
+
+	return cache_submit(cache, &req, 1);
+}
+
+int cache_prefetch(struct cache *cache, const size_t *blocks, size_t count)
+{
+	struct disk_request *reqs = NULL;
+	size_t *missing = NULL;
+	char *data = NULL;
+	size_t i, nmissing = 0;
+	int s, nreqs = 0, ret = -1;
+
+	if (!cache->nslots || !count)
+		return 0;
+
+	if (count > cache->nslots)
+		count = cache->nslots;
+
+	reqs = malloc(count * sizeof(*reqs));
+	missing = malloc(count * sizeof(*missing));
+	data = malloc(count * cache->block_size);
+	if (!reqs || !missing || !data) {
+		perror("malloc");
+		goto out;
+	}
+
+	/* Gather the missing blocks, consecutive ones in the same request */
+	pthread_mutex_lock(&cache->lock);
+	for (i = 0; i < count; i++) {
+		if (cache_lookup(cache, blocks[i]) != NO_SLOT)
+			continue;
+
+		if (nmissing && missing[nmissing - 1] + 1 == blocks[i]) {
+			reqs[nreqs - 1].count++;
+		} else {
+			reqs[nreqs].block = blocks[i];
+			reqs[nreqs].count = 1;
+			reqs[nreqs].buf = data + nmissing * cache->block_size;
+			reqs[nreqs].is_write = 0;
+			nreqs++;
+		}
+		missing[nmissing++] = blocks[i];
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	/* Blocks are read into a private buffer, without holding the lock */
+	if (disk_submit(cache->disk, reqs, nreqs))
+		goto out;
+
+	pthread_mutex_lock(&cache->lock);
+	for (i = 0; i < nmissing; i++) {
+		/* Keep the copy that was cached meanwhile, it may be newer */
+		if (cache_lookup(cache, missing[i]) != NO_SLOT)
+			continue;
+
+		s = cache_insert(cache, missing[i]);
+		if (s == CACHED)
+			continue;
+		if (s == NO_SLOT)
+			break;
+		memcpy(slot_data(cache, s), data + i * cache->block_size,
+		       cache->block_size);
+		cache->slots[s].referenced = 0;
+		cache->stats.prefetches++;
+	}
+	pthread_mutex_unlock(&cache->lock);
+	ret = 0;
+
+out:
+	free(reqs);
+	free(missing);
+	free(data);
+	return ret;
+}
+
+int cache_flush(struct cache *cache)
+{
+	struct disk_request *reqs;
+	int *flushed;
+	size_t i;
+	int n = 0, ret;
+
+	if (!cache->nslots)
+		return 0;
+
+	reqs = malloc(cache->nslots * sizeof(*reqs));
+	flushed = malloc(cache->nslots * sizeof(*flushed));
+	if (!reqs || !flushed) {
+		perror("malloc");
+		free(reqs);
+		free(flushed);
+		return -1;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	/* Blocks being written back by an eviction may fail to, wait for them */
+	for (i = 0; i < cache->nslots;) {
+		if (cache->slots[i].busy && cache->slots[i].dirty) {
+			pthread_cond_wait(&cache->idle, &cache->lock);
+			i = 0;
+		} else {
+			i++;
+		}
+	}
+
+	for (i = 0; i < cache->nslots; i++) {
+		if (!cache->slots[i].valid || !cache->slots[i].dirty)
+			continue;
+		cache->slots[i].busy = 1;
+		reqs[n].block = cache->slots[i].block;
+		reqs[n].count = 1;
+		reqs[n].buf = slot_data(cache, i);
+		reqs[n].is_write = 1;
+		flushed[n] = i;
+		n++;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	/* Write every dirty block back in a single batch */
+	ret = disk_submit(cache->disk, reqs, n);
+
+	pthread_mutex_lock(&cache->lock);
+	for (i = 0; i < (size_t)n; i++) {
+		slot_idle(cache, flushed[i]);
+		if (!ret) {
+			cache->slots[flushed[i]].dirty = 0;
+			cache->stats.writebacks++;
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	free(reqs);
+	free(flushed);
+	return ret;
+}
+
+void cache_get_stats(struct cache *cache, struct cache_stats *stats)
+{
+	pthread_mutex_lock(&cache->lock);
+	*stats = cache->stats;
+	pthread_mutex_unlock(&cache->lock);
+}
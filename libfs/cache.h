@@ -0,0 +1,171 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stddef.h> /* for size_t definition */
+
+#include "disk.h"
+
+/** Block cache in front of an open virtual disk */
+typedef struct cache cache_t;
+
+/** Block cache statistics */
+struct cache_stats {
+	/* Number of block accesses served from the cache */
+	size_t hits;
+	/* Number of block accesses that had to go to disk */
+	size_t misses;
+	/* Number of blocks evicted to make room for another one */
+	size_t evictions;
+	/* Number of dirty blocks written back to disk */
+	size_t writebacks;
+	/* Number of blocks read ahead of their use */
+	size_t prefetches;
+};
+
+/**
+ * cache_create - Create a block cache
+ * @disk: Virtual disk whose blocks are cached
+ * @nblocks: Number of blocks the cache can hold
+ *
+ * Set up a write-back block cache of @nblocks blocks in front of virtual disk
+ * @disk. Blocks are replaced following the CLOCK (second chance)
+ * algorithm. If @nblocks is 0, the cache is disabled and every access is
+ * forwarded to disk_read() or disk_write().
+ *
+ * A cache can be used by several threads at once. Its blocks are the size
+ * disk_block_size() gives for @disk when the cache is created.
+ *
+ * Return: NULL if @disk is NULL or if memory cannot be allocated. Otherwise, the
+ * new cache.
+ */
+cache_t *cache_create(disk_t *disk, size_t nblocks);
+
+/**
+ * cache_destroy - Flush and release a block cache
+ * @cache: Block cache
+ *
+ * Write every dirty block back to disk and free the cache. The disk is left
+ * open. The cache is freed even if a block cannot be written back, so callers
+ * that must not lose dirty blocks call cache_flush() first.
+ *
+ * Return: -1 if @cache is NULL or if a dirty block could not be written back. 0
+ * otherwise.
+ */
+int cache_destroy(cache_t *cache);
+
+/**
+ * cache_read - Read a block through the cache
+ * @cache: Block cache
+ * @block: Index of the block to read from
+ * @buf: Data buffer to be filled with content of block
+ *
+ * Copy the content of block @block into buffer @buf, either from the cache
+ * or, on a miss, from disk. Blocks read from disk are inserted in the cache.
+ *
+ * Return: -1 if the block cannot be read. 0 otherwise.
+ */
+int cache_read(cache_t *cache, size_t block, void *buf);
+
+/**
+ * cache_write - Write a block through the cache
+ * @cache: Block cache
+ * @block: Index of the block to write to
+ * @buf: Data buffer to write in the block
+ *
+ * Copy buffer @buf in the cached copy of block @block and mark it dirty. The
+ * block only reaches the disk when it is evicted or when the cache is flushed.
+ *
+ * Return: -1 if the block cannot be written. 0 otherwise.
+ */
+int cache_write(cache_t *cache, size_t block, const void *buf);
+
+/**
+ * cache_readv - Read a range of contiguous blocks through the cache
+ * @cache: Block cache
+ * @block: Index of the first block to read from
+ * @count: Number of blocks to read
+ * @buf: Data buffer to be filled with the content of the blocks
+ *
+ * Fill buffer @buf with the content of the @count blocks starting at block
+ * @block. Cached blocks are copied from memory, and the runs of missing blocks
+ * are read from disk straight into @buf with a single disk_submit(). Once read,
+ * missing blocks are inserted in the cache, unless @count is more than a
+ * quarter of the blocks the cache can hold: large transfers bypass the cache so
+ * that they do not evict the blocks that are frequently accessed. The cache is
+ * not locked while missing blocks are read, so the caller must make sure that
+ * no other thread writes these blocks at the same time.
+ *
+ * Return: -1 if a block cannot be read. 0 otherwise.
+ */
+int cache_readv(cache_t *cache, size_t block, size_t count, void *buf);
+
+/**
+ * cache_writev - Write a range of contiguous blocks through the cache
+ * @cache: Block cache
+ * @block: Index of the first block to write to
+ * @count: Number of blocks to write
+ * @buf: Data buffer to write in the blocks
+ *
+ * Write buffer @buf in the @count blocks starting at block @block. As with
+ * cache_write(), the blocks are kept in the cache as dirty blocks and only
+ * reach the disk when they are evicted or when the cache is flushed, unless
+ * @count is more than a quarter of the blocks the cache can hold, or unless no
+ * block can be evicted to make room. The blocks are then written with a single
+ * disk_submit(). Their cached copies are updated, and only become clean once
+ * the blocks are written, so that a failed write is retried when the cache is
+ * flushed. As with cache_readv(), the caller must make sure that no other
+ * thread accesses these blocks at the same time.
+ *
+ * Return: -1 if the blocks cannot be written. 0 otherwise.
+ */
+int cache_writev(cache_t *cache, size_t block, size_t count,
+		 const void *buf);
+
+/**
+ * cache_submit - Perform a batch of block requests through the cache
+ * @cache: Block cache
+ * @reqs: Array of requests
+ * @nreqs: Number of requests in @reqs
+ *
+ * Same as cache_readv() and cache_writev() for every request of @reqs, except
+ * that every disk access that the batch needs is performed with a single
+ * disk_submit(), so that the disk works on all of them at once.
+ *
+ * Return: -1 if a request fails. 0 otherwise.
+ */
+int cache_submit(cache_t *cache, const struct disk_request *reqs, int nreqs);
+
+/**
+ * cache_prefetch - Read blocks into the cache ahead of their use
+ * @cache: Block cache
+ * @blocks: Array of block indexes
+ * @count: Number of blocks in @blocks
+ *
+ * Insert the blocks of @blocks that are not cached yet in the cache, reading
+ * them from disk with a single disk_submit(). Prefetched blocks are the first
+ * ones to be evicted until they are accessed, so that blocks read ahead but
+ * never used do not push out the frequently accessed ones. At most as many
+ * blocks as the cache can hold are prefetched. As with cache_readv(), the
+ * caller must make sure that no other thread writes these blocks at the same
+ * time.
+ *
+ * Return: -1 if the blocks cannot be read. 0 otherwise.
+ */
+int cache_prefetch(cache_t *cache, const size_t *blocks, size_t count);
+
+/**
+ * cache_flush - Write dirty blocks back to disk
+ * @cache: Block cache
+ *
+ * Return: -1 if a dirty block could not be written back. 0 otherwise.
+ */
+int cache_flush(cache_t *cache);
+
+/**
+ * cache_get_stats - Get cache statistics
+ * @cache: Block cache
+ * @stats: Structure to be filled with the cache counters
+ */
+void cache_get_stats(cache_t *cache, struct cache_stats *stats);
+
+#endif /* _CACHE_H */
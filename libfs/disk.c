@@ -1,17 +1,47 @@
+#include <errno.h>
 #include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+/* Defined by <linux/fs.h>, which <linux/io_uring.h> includes */
+#undef BLOCK_SIZE
+
 #include "disk.h"
+#include "stats.h"
 
 #define block_error(fmt, ...) \
 	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
 
-/* Invalid file descriptor */
-#define INVALID_FD -1
+/* Number of requests that an io_uring instance can hold */
+#define RING_ENTRIES 64
+
+/* io_uring instance of a thread, set up with raw system calls */
+struct ring {
+	/* Ring file descriptor, -1 if io_uring is not available */
+	int fd;
+	/* Number of submission queue entries */
+	unsigned entries;
+	/* Submission queue ring */
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	struct io_uring_sqe *sqes;
+	/* Completion queue ring */
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	/* Mappings of the rings */
+	void *sq_ptr, *cq_ptr;
+	size_t sq_len, cq_len, sqes_len;
+};
 
 /* Disk instance description */
 struct disk {
@@ -19,126 +49,817 @@ struct disk {
 	int fd;
 	/* Block count */
 	size_t bcount;
+	/* Block size, %BLOCK_SIZE unless changed with disk_set_block_size() */
+	size_t block_size;
+	/* Size of the disk image, in bytes */
+	size_t size;
+	/* Backend serving the block accesses */
+	int backend;
+	/* Mapping of the whole disk image (memory-mapped backend only) */
+	char *map;
+	/* Trace file the accesses are recorded to, NULL if not traced */
+	FILE *trace;
+	/* Time the trace was started, in nanoseconds */
+	uint64_t trace_start;
 };
 
-/* Currently open virtual disk (invalid by default) */
-static struct disk disk = { .fd = INVALID_FD };
+/* Disk opened with block_disk_open(), used by the block_*() functions */
+static struct disk *default_disk;
 
-int block_disk_open(const char *diskname)
+/*
+ * Ring of the calling thread, set up the first time it submits a batch, and
+ * shared by every disk it accesses. Each thread has its own, so that the
+ * batches of concurrent threads are all submitted at once.
+ */
+static __thread struct ring *thread_ring;
+/* Releases the ring of a thread when it exits */
+static pthread_key_t ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+
+static void ring_teardown(struct ring *ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+		munmap(ring->cq_ptr, ring->cq_len);
+	if (ring->sq_ptr)
+		munmap(ring->sq_ptr, ring->sq_len);
+	if (ring->fd >= 0)
+		close(ring->fd);
+	ring->sq_ptr = ring->cq_ptr = NULL;
+	ring->sqes = NULL;
+	ring->fd = -1;
+}
+
+/*
+ * Set up an io_uring instance. On failure, the ring is left unavailable and
+ * batched requests fall back to positional system calls.
+ */
+static void ring_setup(struct ring *ring)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	ring->fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+	if (ring->fd < 0)
+		return;
+
+	ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_len > ring->sq_len)
+			ring->sq_len = ring->cq_len;
+		ring->cq_len = ring->sq_len;
+	}
+
+	ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring->fd,
+			    IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED) {
+		ring->sq_ptr = NULL;
+		goto fail;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ptr = ring->sq_ptr;
+	} else {
+		ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_POPULATE, ring->fd,
+				    IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED) {
+			ring->cq_ptr = NULL;
+			goto fail;
+		}
+	}
+
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto fail;
+	}
+
+	sq = ring->sq_ptr;
+	cq = ring->cq_ptr;
+	ring->entries = p.sq_entries;
+	ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+	ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+	ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	return;
+
+fail:
+	ring_teardown(ring);
+}
+
+static void ring_release(void *arg)
+{
+	struct ring *ring = arg;
+
+	ring_teardown(ring);
+	free(ring);
+}
+
+static void ring_key_create(void)
+{
+	pthread_key_create(&ring_key, ring_release);
+}
+
+/* Get the ring of the calling thread, NULL if io_uring is not available */
+static struct ring *ring_get(void)
 {
+	struct ring *ring = thread_ring;
+
+	if (!ring) {
+		ring = calloc(1, sizeof(*ring));
+		if (!ring)
+			return NULL;
+		ring_setup(ring);
+		pthread_once(&ring_once, ring_key_create);
+		pthread_setspecific(ring_key, ring);
+		thread_ring = ring;
+	}
+
+	return ring->fd < 0 ? NULL : ring;
+}
+
+struct disk *disk_open(const char *diskname, int backend)
+{
+	struct disk *disk;
+	char *map = NULL;
 	int fd;
 	struct stat st;
 
 	if (!diskname) {
 		block_error("invalid file diskname");
-		return -1;
+		return NULL;
 	}
 
-	if (disk.fd != INVALID_FD) {
-		block_error("disk already open");
-		return -1;
+	if (backend != BLOCK_BACKEND_FILE && backend != BLOCK_BACKEND_MMAP) {
+		block_error("invalid backend '%d'", backend);
+		return NULL;
 	}
 
 	if ((fd = open(diskname, O_RDWR, 0644)) < 0) {
 		perror("open");
-		return -1;
+		return NULL;
 	}
 
 	if (fstat(fd, &st)) {
 		perror("fstat");
-		return -1;
+		close(fd);
+		return NULL;
 	}
 
 	/* The disk image's size should be a multiple of the block size */
 	if (st.st_size % BLOCK_SIZE != 0) {
 		block_error("size '%zu' is not multiple of '%d'",
 			    st.st_size, BLOCK_SIZE);
-		return -1;
+		close(fd);
+		return NULL;
 	}
 
-	disk.fd = fd;
-	disk.bcount = st.st_size / BLOCK_SIZE;
+	/* Map the whole disk image, accesses then become plain memory copies */
+	if (backend == BLOCK_BACKEND_MMAP) {
+		map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   fd, 0);
+		if (map == MAP_FAILED) {
+			perror("mmap");
+			close(fd);
+			return NULL;
+		}
+	}
 
-	return 0;
+	disk = malloc(sizeof(*disk));
+	if (!disk) {
+		perror("malloc");
+		if (map)
+			munmap(map, st.st_size);
+		close(fd);
+		return NULL;
+	}
+
+	disk->fd = fd;
+	disk->bcount = st.st_size / BLOCK_SIZE;
+	disk->block_size = BLOCK_SIZE;
+	disk->size = st.st_size;
+	disk->backend = backend;
+	disk->map = map;
+
+	disk->trace = NULL;
+
+	return disk;
 }
 
-int block_disk_close(void)
+int disk_close(struct disk *disk)
 {
-	if (disk.fd == INVALID_FD) {
+	int ret = 0;
+
+	if (!disk) {
 		block_error("no disk currently open");
 		return -1;
 	}
 
-	close(disk.fd);
+	if (disk->trace && fclose(disk->trace)) {
+		perror("fclose");
+		ret = -1;
+	}
+
+	if (disk->map) {
+		if (msync(disk->map, disk->size, MS_SYNC))
+			perror("msync");
+		munmap(disk->map, disk->size);
+	}
 
-	disk.fd = INVALID_FD;
+	close(disk->fd);
+	free(disk);
+
+	return ret;
+}
+
+static uint64_t trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int disk_trace(struct disk *disk, const char *filename)
+{
+	struct disk_trace_header header;
+
+	if (!disk || !filename) {
+		block_error("invalid disk or trace filename");
+		return -1;
+	}
+
+	if (disk->trace) {
+		block_error("disk already traced");
+		return -1;
+	}
+
+	disk->trace = fopen(filename, "w");
+	if (!disk->trace) {
+		perror("fopen");
+		return -1;
+	}
+
+	header.magic = DISK_TRACE_MAGIC;
+	header.version = DISK_TRACE_VERSION;
+	header.record_size = sizeof(struct disk_trace_record);
+	header.block_size = disk->block_size;
+	header.block_count = disk->bcount;
+	if (fwrite(&header, sizeof(header), 1, disk->trace) != 1) {
+		perror("fwrite");
+		fclose(disk->trace);
+		disk->trace = NULL;
+		return -1;
+	}
+	disk->trace_start = trace_now();
 
 	return 0;
 }
 
-int block_disk_count(void)
+/*
+ * Record an access to the trace, split into as many records as its block count
+ * requires. Each record is written at once, so records of concurrent accesses
+ * do not interleave.
+ */
+static void trace_access(struct disk *disk, size_t block, size_t count,
+			 int type)
+{
+	struct disk_trace_record rec;
+	int op = stats_origin();
+
+	rec.time_ns = trace_now() - disk->trace_start;
+	rec.type = type;
+	rec.op = op < 0 ? DISK_TRACE_NO_OP : op;
+	do {
+		rec.block = block;
+		rec.count = count > UINT16_MAX ? UINT16_MAX : count;
+		if (fwrite(&rec, sizeof(rec), 1, disk->trace) != 1)
+			perror("fwrite");
+		block += rec.count;
+		count -= rec.count;
+	} while (count > 0);
+}
+
+/* Account for blocks about to be transferred */
+static void block_access(struct disk *disk, size_t block, size_t count,
+			 int is_write)
+{
+	STATS_BLOCKS(count, is_write);
+	if (disk->trace)
+		trace_access(disk, block, count,
+			     is_write ? DISK_TRACE_WRITE : DISK_TRACE_READ);
+}
+
+int disk_count(struct disk *disk)
 {
-	if (disk.fd == INVALID_FD) {
+	if (!disk) {
 		block_error("no disk currently open");
 		return -1;
 	}
 
-	return disk.bcount;
+	return disk->bcount;
 }
 
-int block_write(size_t block, const void *buf)
+int disk_set_block_size(struct disk *disk, size_t block_size)
 {
-	if (disk.fd == INVALID_FD) {
+	if (!disk) {
 		block_error("no disk currently open");
 		return -1;
 	}
 
-	if (block >= disk.bcount) {
-		block_error("block index out of bounds (%zu/%zu)",
-			    block, disk.bcount);
+	if (block_size < BLOCK_SIZE || block_size > BLOCK_SIZE_MAX ||
+	    (block_size & (block_size - 1))) {
+		block_error("invalid block size '%zu'", block_size);
 		return -1;
 	}
 
-	/* Move to the specified block number */
-	if (lseek(disk.fd, block * BLOCK_SIZE, SEEK_SET) < 0) {
-		perror("lseek");
+	if (disk->size % block_size != 0) {
+		block_error("size '%zu' is not multiple of '%zu'",
+			    disk->size, block_size);
 		return -1;
 	}
 
-	/* Perform the actual write into the disk image */
-	if (write(disk.fd, buf, BLOCK_SIZE) < 0) {
-		perror("write");
+	if (disk->trace) {
+		block_error("block size of a traced disk cannot change");
 		return -1;
 	}
 
+	disk->block_size = block_size;
+	disk->bcount = disk->size / block_size;
+
 	return 0;
 }
 
-int block_read(size_t block, void *buf)
+size_t disk_block_size(struct disk *disk)
 {
-	if (disk.fd == INVALID_FD) {
+	return disk ? disk->block_size : BLOCK_SIZE;
+}
+
+/*
+ * Check that the @count blocks starting at @block can be accessed, and that
+ * the I/O vector covers exactly that many blocks
+ */
+static int block_check_range(struct disk *disk, size_t block, size_t count,
+			     const struct iovec *iov, int iovcnt)
+{
+	size_t len = 0;
+	int i;
+
+	if (!disk) {
 		block_error("no disk currently open");
 		return -1;
 	}
 
-	if (block >= disk.bcount) {
+	if (block >= disk->bcount || count > disk->bcount - block) {
 		block_error("block index out of bounds (%zu/%zu)",
-			    block, disk.bcount);
+			    block + count - 1, disk->bcount);
+		return -1;
+	}
+
+	if (!iov)
+		return 0;
+
+	if (iovcnt <= 0 || iovcnt > BLOCK_IOV_MAX) {
+		block_error("invalid I/O vector count (%d)", iovcnt);
+		return -1;
+	}
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	if (len != count * disk->block_size) {
+		block_error("I/O vector length '%zu' does not match '%zu' blocks",
+			    len, count);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Transfer a contiguous range of blocks described by an I/O vector. Short
+ * transfers are resumed until the whole range is done, which requires a
+ * private copy of the vector so that the caller's one stays untouched.
+ */
+static int block_transfer(struct disk *disk, off_t off,
+			  const struct iovec *iov, int iovcnt, int is_write)
+{
+	struct iovec vec[BLOCK_IOV_MAX];
+	struct iovec *cur = vec;
+	ssize_t ret;
+	int i;
+
+	if (disk->map) {
+		for (i = 0; i < iovcnt; i++) {
+			if (is_write)
+				memcpy(disk->map + off, iov[i].iov_base,
+				       iov[i].iov_len);
+			else
+				memcpy(iov[i].iov_base, disk->map + off,
+				       iov[i].iov_len);
+			off += iov[i].iov_len;
+		}
+		return 0;
+	}
+
+	for (i = 0; i < iovcnt; i++)
+		vec[i] = iov[i];
+
+	while (iovcnt > 0) {
+		if (is_write)
+			ret = pwritev(disk->fd, cur, iovcnt, off);
+		else
+			ret = preadv(disk->fd, cur, iovcnt, off);
+
+		if (ret < 0) {
+			perror(is_write ? "pwritev" : "preadv");
+			return -1;
+		}
+		if (ret == 0) {
+			block_error("unexpected end of disk image");
+			return -1;
+		}
+
+		off += ret;
+		while (iovcnt > 0 && (size_t)ret >= cur->iov_len) {
+			ret -= cur->iov_len;
+			cur++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			cur->iov_base = (char *)cur->iov_base + ret;
+			cur->iov_len -= ret;
+		}
+	}
+
+	return 0;
+}
+
+int disk_write(struct disk *disk, size_t block, const void *buf)
+{
+	STATS_OP(FS_OP_BLOCK_WRITE);
+	size_t done = 0;
+	ssize_t ret;
+
+	if (block_check_range(disk, block, 1, NULL, 0))
+		return -1;
+	block_access(disk, block, 1, 1);
+
+	if (disk->map) {
+		memcpy(disk->map + block * disk->block_size, buf, disk->block_size);
+		return 0;
+	}
+
+	/* Perform the actual write into the disk image at the block's offset */
+	while (done < disk->block_size) {
+		ret = pwrite(disk->fd, (const char *)buf + done,
+			     disk->block_size - done,
+			     block * disk->block_size + done);
+		if (ret < 0) {
+			perror("pwrite");
+			return -1;
+		}
+		done += ret;
+	}
+
+	return 0;
+}
+
+int disk_read(struct disk *disk, size_t block, void *buf)
+{
+	STATS_OP(FS_OP_BLOCK_READ);
+	size_t done = 0;
+	ssize_t ret;
+
+	if (block_check_range(disk, block, 1, NULL, 0))
 		return -1;
+	block_access(disk, block, 1, 0);
+
+	if (disk->map) {
+		memcpy(buf, disk->map + block * disk->block_size, disk->block_size);
+		return 0;
+	}
+
+	/* Perform the actual read from the disk image at the block's offset */
+	while (done < disk->block_size) {
+		ret = pread(disk->fd, (char *)buf + done, disk->block_size - done,
+			    block * disk->block_size + done);
+		if (ret < 0) {
+			perror("pread");
+			return -1;
+		}
+		if (ret == 0) {
+			block_error("unexpected end of disk image");
+			return -1;
+		}
+		done += ret;
 	}
 
-	/* Move to the specified block number */
-	if (lseek(disk.fd, block * BLOCK_SIZE, SEEK_SET) < 0) {
-		perror("lseek");
+	return 0;
+}
+
+int disk_writev(struct disk *disk, size_t block, size_t count,
+		const struct iovec *iov, int iovcnt)
+{
+	STATS_OP(FS_OP_BLOCK_WRITEV);
+
+	if (block_check_range(disk, block, count, iov, iovcnt))
 		return -1;
+	block_access(disk, block, count, 1);
+
+	return block_transfer(disk, block * disk->block_size, iov, iovcnt, 1);
+}
+
+int disk_readv(struct disk *disk, size_t block, size_t count,
+	       const struct iovec *iov, int iovcnt)
+{
+	STATS_OP(FS_OP_BLOCK_READV);
+
+	if (block_check_range(disk, block, count, iov, iovcnt))
+		return -1;
+	block_access(disk, block, count, 0);
+
+	return block_transfer(disk, block * disk->block_size, iov, iovcnt, 0);
+}
+
+/* Complete a request that the ring only partially transferred */
+static int request_resume(struct disk *disk, const struct disk_request *req,
+			  size_t done)
+{
+	struct iovec iov;
+
+	iov.iov_base = (char *)req->buf + done;
+	iov.iov_len = req->count * disk->block_size - done;
+	return block_transfer(disk, req->block * disk->block_size + done, &iov, 1,
+			      req->is_write);
+}
+
+static int ring_enter(struct ring *ring, unsigned to_submit,
+		      unsigned min_complete)
+{
+	int ret;
+
+	do {
+		ret = syscall(__NR_io_uring_enter, ring->fd, to_submit,
+			      min_complete, IORING_ENTER_GETEVENTS, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret;
+}
+
+/*
+ * Submit up to one ring's worth of requests at once, then wait for all of them
+ * to complete. Each entry of @status is set to 1 once its request succeeds, or
+ * to -1 if it fails, and left to 0 if the request has not been performed.
+ * Returns -1 if the ring cannot be used anymore, 0 otherwise.
+ */
+static int ring_submit(struct ring *ring, struct disk *disk,
+		       const struct disk_request *reqs, int nreqs,
+		       signed char *status)
+{
+	struct iovec iov[RING_ENTRIES];
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	unsigned tail, head, idx;
+	int i, submitted;
+
+	tail = *ring->sq_tail;
+	for (i = 0; i < nreqs; i++) {
+		iov[i].iov_base = reqs[i].buf;
+		iov[i].iov_len = reqs[i].count * disk->block_size;
+
+		idx = tail & *ring->sq_mask;
+		sqe = &ring->sqes[idx];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = reqs[i].is_write ? IORING_OP_WRITEV : IORING_OP_READV;
+		sqe->fd = disk->fd;
+		sqe->addr = (unsigned long)&iov[i];
+		sqe->len = 1;
+		sqe->off = reqs[i].block * disk->block_size;
+		sqe->user_data = i;
+		ring->sq_array[idx] = idx;
+		tail++;
+	}
+	__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+	submitted = ring_enter(ring, nreqs, 0);
+	if (submitted < 0) {
+		if (errno != EAGAIN && errno != EBUSY)
+			return -1;
+		submitted = 0;
+	}
+
+	/*
+	 * Take back the entries the kernel did not consume, they point at this
+	 * call's I/O vectors and would otherwise be submitted by the next one
+	 */
+	if (submitted < nreqs)
+		__atomic_store_n(ring->sq_tail, tail - (nreqs - submitted),
+				 __ATOMIC_RELEASE);
+
+	/*
+	 * Reap every completion before the I/O vectors and the caller's buffers
+	 * go out of scope. Waiting only fails for good if the ring itself is
+	 * broken, and the requests still pending are then left to the caller.
+	 */
+	for (i = 0; i < submitted;) {
+		head = *ring->cq_head;
+		if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+			if (ring_enter(ring, 0, 1) < 0) {
+				if (errno != EAGAIN && errno != EBUSY)
+					return -1;
+				sched_yield();
+			}
+			continue;
+		}
+
+		cqe = &ring->cqes[head & *ring->cq_mask];
+		idx = cqe->user_data;
+		if (cqe->res < 0) {
+			errno = -cqe->res;
+			perror(reqs[idx].is_write ? "pwritev" : "preadv");
+			status[idx] = -1;
+		} else if ((size_t)cqe->res < iov[idx].iov_len &&
+			   request_resume(disk, &reqs[idx], cqe->res)) {
+			status[idx] = -1;
+		} else {
+			status[idx] = 1;
+		}
+		__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+		i++;
+	}
+
+	return 0;
+}
+
+int disk_submit(struct disk *disk, const struct disk_request *reqs, int nreqs)
+{
+	STATS_OP(FS_OP_BLOCK_SUBMIT);
+	signed char status[RING_ENTRIES];
+	struct ring *ring;
+	int i, j, n, ret = 0;
+
+	for (i = 0; i < nreqs; i++) {
+		if (block_check_range(disk, reqs[i].block, reqs[i].count,
+				      NULL, 0))
+			return -1;
 	}
+	for (i = 0; i < nreqs; i++)
+		block_access(disk, reqs[i].block, reqs[i].count,
+			     reqs[i].is_write);
 
-	/* Perform the actual read from the disk image */
-	if (read(disk.fd, buf, BLOCK_SIZE) < 0) {
-		perror("read");
+	/*
+	 * Mapped blocks are accessed in memory, and without io_uring requests
+	 * are issued synchronously
+	 */
+	ring = disk->map ? NULL : ring_get();
+
+	for (i = 0; i < nreqs; i += n) {
+		n = nreqs - i;
+		if (n > RING_ENTRIES)
+			n = RING_ENTRIES;
+		if (ring && n > (int)ring->entries)
+			n = ring->entries;
+
+		memset(status, 0, n);
+		if (ring && ring_submit(ring, disk, reqs + i, n, status)) {
+			/* The ring is broken, stop using it in this thread */
+			perror("io_uring_enter");
+			ring_teardown(ring);
+			ring = NULL;
+		}
+
+		/* Requests the ring did not perform are done synchronously */
+		for (j = 0; j < n; j++) {
+			if (status[j] < 0 ||
+			    (!status[j] && request_resume(disk, &reqs[i + j], 0)))
+				ret = -1;
+		}
+	}
+
+	return ret;
+}
+
+int disk_sync(struct disk *disk)
+{
+	STATS_OP(FS_OP_BLOCK_SYNC);
+
+	if (!disk) {
+		block_error("no disk currently open");
 		return -1;
 	}
 
+	if (disk->trace)
+		trace_access(disk, 0, 0, DISK_TRACE_SYNC);
+
+	if (disk->map) {
+		if (msync(disk->map, disk->size, MS_SYNC)) {
+			perror("msync");
+			return -1;
+		}
+		return 0;
+	}
+
+	if (fdatasync(disk->fd)) {
+		perror("fdatasync");
+		return -1;
+	}
+
+	return 0;
+}
+
+void *disk_ptr(struct disk *disk, size_t block)
+{
+	if (!disk || !disk->map)
+		return NULL;
+
+	if (block >= disk->bcount) {
+		block_error("block index out of bounds (%zu/%zu)",
+			    block, disk->bcount);
+		return NULL;
+	}
+
+	return disk->map + block * disk->block_size;
+}
+
+int block_disk_open(const char *diskname)
+{
+	return block_disk_open_backend(diskname, BLOCK_BACKEND_FILE);
+}
+
+int block_disk_open_backend(const char *diskname, int backend)
+{
+	if (default_disk) {
+		block_error("disk already open");
+		return -1;
+	}
+
+	default_disk = disk_open(diskname, backend);
+	if (!default_disk)
+		return -1;
+
+	return 0;
+}
+
+int block_disk_close(void)
+{
+	if (disk_close(default_disk))
+		return -1;
+
+	default_disk = NULL;
+
 	return 0;
 }
 
+int block_disk_count(void)
+{
+	return disk_count(default_disk);
+}
+
+int block_write(size_t block, const void *buf)
+{
+	return disk_write(default_disk, block, buf);
+}
+
+int block_read(size_t block, void *buf)
+{
+	return disk_read(default_disk, block, buf);
+}
+
+int block_writev(size_t block, size_t count, const struct iovec *iov,
+		 int iovcnt)
+{
+	return disk_writev(default_disk, block, count, iov, iovcnt);
+}
+
+int block_readv(size_t block, size_t count, const struct iovec *iov,
+		int iovcnt)
+{
+	return disk_readv(default_disk, block, count, iov, iovcnt);
+}
+
+int block_submit(const struct disk_request *reqs, int nreqs)
+{
+	return disk_submit(default_disk, reqs, nreqs);
+}
+
+int block_sync(void)
+{
+	return disk_sync(default_disk);
+}
+
+void *block_ptr(size_t block)
+{
+	return disk_ptr(default_disk, block);
+}
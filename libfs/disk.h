@@ -2,10 +2,265 @@
 #define _DISK_H
 
 #include <stddef.h> /* for size_t definition */
+#include <stdint.h> /* for fixed-width integer definitions */
+#include <sys/uio.h> /* for struct iovec definition */
 
 /** Size of a disk block in bytes */
 #define BLOCK_SIZE 4096
 
+/** Largest block size that can be set with disk_set_block_size() */
+#define BLOCK_SIZE_MAX 65536
+
+/** Maximum number of buffers in the I/O vector of a vectored block operation */
+#define BLOCK_IOV_MAX 1024
+
+/** Disk backends */
+enum {
+	/** Blocks are accessed with positional read and write system calls */
+	BLOCK_BACKEND_FILE,
+	/** Whole disk image is memory-mapped, blocks are accessed in memory */
+	BLOCK_BACKEND_MMAP,
+};
+
+/** Open virtual disk */
+typedef struct disk disk_t;
+
+/** Request for a range of contiguous blocks, for batched submission */
+struct disk_request {
+	/** Index of the first block */
+	size_t block;
+	/** Number of blocks */
+	size_t count;
+	/** Data buffer of @count blocks */
+	void *buf;
+	/** Write the blocks if set, otherwise read them */
+	int is_write;
+};
+
+/** Magic number at the start of a block trace file ("TRCE") */
+#define DISK_TRACE_MAGIC 0x45435254
+
+/** Version of the block trace format */
+#define DISK_TRACE_VERSION 1
+
+/** Operation of a traced access made outside of any fs_*() call */
+#define DISK_TRACE_NO_OP 0xFF
+
+/** Kinds of traced block accesses */
+enum {
+	/** Blocks read from the disk */
+	DISK_TRACE_READ,
+	/** Blocks written to the disk */
+	DISK_TRACE_WRITE,
+	/** Disk synced, the record covers no block */
+	DISK_TRACE_SYNC,
+};
+
+/**
+ * Header of a block trace file. It is followed by one record per access, in
+ * the byte order of the host that recorded them.
+ */
+struct disk_trace_header {
+	/** %DISK_TRACE_MAGIC */
+	uint32_t magic;
+	/** %DISK_TRACE_VERSION */
+	uint16_t version;
+	/** Size of a record, in bytes */
+	uint16_t record_size;
+	/** Size of a block, in bytes */
+	uint32_t block_size;
+	/** Number of blocks of the traced disk */
+	uint32_t block_count;
+};
+
+/** Block trace record */
+struct disk_trace_record {
+	/** Time of the access, in nanoseconds since the trace was started */
+	uint64_t time_ns;
+	/** Index of the first block */
+	uint32_t block;
+	/** Number of contiguous blocks */
+	uint16_t count;
+	/** %DISK_TRACE_READ, %DISK_TRACE_WRITE or %DISK_TRACE_SYNC */
+	uint8_t type;
+	/** fs_*() operation the access was made from, such as %FS_OP_READ */
+	uint8_t op;
+};
+
+/**
+ * disk_open - Open a virtual disk file and return a handle to it
+ * @diskname: Name of the virtual disk file
+ * @backend: Backend serving block accesses (%BLOCK_BACKEND_FILE or
+ * %BLOCK_BACKEND_MMAP)
+ *
+ * Open virtual disk file @diskname, independently of the disk opened with
+ * block_disk_open() and of any other disk opened with disk_open(). The disk_*()
+ * functions behave as the block_*() functions of the same name, but on the
+ * returned disk.
+ *
+ * Return: NULL if @diskname or @backend is invalid, or if the virtual disk file
+ * cannot be opened or mapped. Otherwise, a handle to the open disk.
+ */
+disk_t *disk_open(const char *diskname, int backend);
+
+/**
+ * disk_close - Close a virtual disk opened with disk_open()
+ * @disk: Disk to close
+ *
+ * Return: -1 if @disk is NULL, or if the block trace being recorded cannot be
+ * written. 0 otherwise.
+ */
+int disk_close(disk_t *disk);
+
+/**
+ * disk_trace - Record the block accesses of a disk
+ * @disk: Disk opened with disk_open()
+ * @filename: Name of the trace file, created or truncated
+ *
+ * Record every block read, written or submitted, and every sync, of @disk to
+ * trace file @filename until the disk is closed. Blocks accessed in place
+ * through disk_ptr() are not recorded. Accesses made outside of any fs_*()
+ * operation are recorded with operation %DISK_TRACE_NO_OP.
+ *
+ * Return: -1 if @disk is NULL, if it is already traced, or if trace file
+ * @filename cannot be created. 0 otherwise.
+ */
+int disk_trace(disk_t *disk, const char *filename);
+
+/**
+ * disk_count - Get the block count of a disk
+ * @disk: Disk opened with disk_open()
+ *
+ * Same as block_disk_count(), in blocks of disk_block_size() bytes.
+ *
+ * Return: -1 if @disk is NULL. Otherwise, the number of blocks that @disk
+ * contains.
+ */
+int disk_count(disk_t *disk);
+
+/**
+ * disk_set_block_size - Change the block size of a disk
+ * @disk: Disk opened with disk_open()
+ * @block_size: New block size, in bytes
+ *
+ * Disks are opened with %BLOCK_SIZE bytes blocks. Once the block size is
+ * changed, block indexes, block counts and data buffers given to the other
+ * disk_*() functions are in blocks of @block_size bytes instead, and
+ * disk_count() is updated to match.
+ *
+ * Return: -1 if @disk is NULL or traced, if @block_size is not a power of two
+ * from %BLOCK_SIZE to %BLOCK_SIZE_MAX, or if the size of the virtual disk file
+ * is not a multiple of @block_size. 0 otherwise.
+ */
+int disk_set_block_size(disk_t *disk, size_t block_size);
+
+/**
+ * disk_block_size - Get the block size of a disk
+ * @disk: Disk opened with disk_open()
+ *
+ * Return: %BLOCK_SIZE if @disk is NULL. Otherwise, the size of its blocks in
+ * bytes.
+ */
+size_t disk_block_size(disk_t *disk);
+
+/**
+ * disk_write - Write a block to a disk
+ * @disk: Disk opened with disk_open()
+ * @block: Index of the block to write to
+ * @buf: Data buffer to write in the block
+ *
+ * Same as block_write(), on @disk, with a buffer of disk_block_size() bytes.
+ *
+ * Return: -1 if @disk is NULL, if @block is out of bounds or inaccessible, or
+ * if the writing operation fails. 0 otherwise.
+ */
+int disk_write(disk_t *disk, size_t block, const void *buf);
+
+/**
+ * disk_read - Read a block from a disk
+ * @disk: Disk opened with disk_open()
+ * @block: Index of the block to read from
+ * @buf: Data buffer to be filled with content of block
+ *
+ * Same as block_read(), on @disk, with a buffer of disk_block_size() bytes.
+ *
+ * Return: -1 if @disk is NULL, if @block is out of bounds or inaccessible, or
+ * if the reading operation fails. 0 otherwise.
+ */
+int disk_read(disk_t *disk, size_t block, void *buf);
+
+/**
+ * disk_writev - Write a range of contiguous blocks to a disk
+ * @disk: Disk opened with disk_open()
+ * @block: Index of the first block to write to
+ * @count: Number of blocks to write
+ * @iov: I/O vector describing the data buffers to write
+ * @iovcnt: Number of elements in @iov (at most %BLOCK_IOV_MAX)
+ *
+ * Same as block_writev(), on @disk. The lengths of the buffers must add up to
+ * exactly @count * disk_block_size() bytes.
+ *
+ * Return: -1 if @disk is NULL, if the block range is out of bounds or
+ * inaccessible, if the I/O vector does not cover the range, or if the writing
+ * operation fails. 0 otherwise.
+ */
+int disk_writev(disk_t *disk, size_t block, size_t count,
+		const struct iovec *iov, int iovcnt);
+
+/**
+ * disk_readv - Read a range of contiguous blocks from a disk
+ * @disk: Disk opened with disk_open()
+ * @block: Index of the first block to read from
+ * @count: Number of blocks to read
+ * @iov: I/O vector describing the data buffers to be filled
+ * @iovcnt: Number of elements in @iov (at most %BLOCK_IOV_MAX)
+ *
+ * Same as block_readv(), on @disk. The lengths of the buffers must add up to
+ * exactly @count * disk_block_size() bytes.
+ *
+ * Return: -1 if @disk is NULL, if the block range is out of bounds or
+ * inaccessible, if the I/O vector does not cover the range, or if the reading
+ * operation fails. 0 otherwise.
+ */
+int disk_readv(disk_t *disk, size_t block, size_t count,
+	       const struct iovec *iov, int iovcnt);
+
+/**
+ * disk_submit - Perform a batch of block requests on a disk
+ * @disk: Disk opened with disk_open()
+ * @reqs: Array of requests
+ * @nreqs: Number of requests in @reqs
+ *
+ * Same as block_submit(), on @disk, in blocks of disk_block_size() bytes.
+ *
+ * Return: -1 if @disk is NULL, if a block range is out of bounds or
+ * inaccessible, or if a request fails. 0 otherwise.
+ */
+int disk_submit(disk_t *disk, const struct disk_request *reqs, int nreqs);
+
+/**
+ * disk_sync - Make the blocks written so far to a disk durable
+ * @disk: Disk opened with disk_open()
+ *
+ * Same as block_sync(), on @disk.
+ *
+ * Return: -1 if @disk is NULL, or if the blocks cannot be synced. 0 otherwise.
+ */
+int disk_sync(disk_t *disk);
+
+/**
+ * disk_ptr - Get direct access to a block of a disk
+ * @disk: Disk opened with disk_open()
+ * @block: Index of the block
+ *
+ * Same as block_ptr(), on @disk, for a block of disk_block_size() bytes. The
+ * pointer becomes invalid when @disk is closed.
+ *
+ * Return: NULL if @disk is NULL or not memory-mapped, or if @block is out of
+ * bounds. Otherwise, a pointer to the block's content.
+ */
+void *disk_ptr(disk_t *disk, size_t block);
+
 /**
  * block_disk_open - Open virtual disk file
  * @diskname: Name of the virtual disk file
@@ -19,9 +274,29 @@
  */
 int block_disk_open(const char *diskname);
 
+/**
+ * block_disk_open_backend - Open virtual disk file with a given backend
+ * @diskname: Name of the virtual disk file
+ * @backend: Backend serving block accesses (%BLOCK_BACKEND_FILE or
+ * %BLOCK_BACKEND_MMAP)
+ *
+ * Same as block_disk_open(), but select how blocks are accessed. With
+ * %BLOCK_BACKEND_MMAP, the whole virtual disk file is mapped in memory: block
+ * accesses become memory copies and block_ptr() gives direct access to the
+ * content of blocks. Modifications are synced to the file when the disk is
+ * closed.
+ *
+ * Return: -1 if @diskname or @backend is invalid, if the virtual disk file
+ * cannot be opened or mapped, or is already open. 0 otherwise.
+ */
+int block_disk_open_backend(const char *diskname, int backend);
+
 /**
  * block_disk_close - Close virtual disk file
  *
+ * If the virtual disk file was memory-mapped, modifications are synced to the
+ * file before it is unmapped.
+ *
  * Return: -1 if there was no virtual disk file opened. 0 otherwise.
  */
 int block_disk_close(void);
@@ -60,5 +335,87 @@ int block_write(size_t block, const void *buf);
  */
 int block_read(size_t block, void *buf);
 
+/**
+ * block_writev - Write a range of contiguous blocks to disk
+ * @block: Index of the first block to write to
+ * @count: Number of blocks to write
+ * @iov: I/O vector describing the data buffers to write
+ * @iovcnt: Number of elements in @iov (at most %BLOCK_IOV_MAX)
+ *
+ * Gather the buffers described by @iov, whose lengths must add up to exactly
+ * @count * %BLOCK_SIZE bytes, and write them in the @count virtual disk's blocks
+ * starting at block @block, using a single positional system call whenever
+ * possible.
+ *
+ * Return: -1 if the block range is out of bounds or inaccessible, if the I/O
+ * vector does not cover the range, or if the writing operation fails. 0
+ * otherwise.
+ */
+int block_writev(size_t block, size_t count, const struct iovec *iov,
+		 int iovcnt);
+
+/**
+ * block_readv - Read a range of contiguous blocks from disk
+ * @block: Index of the first block to read from
+ * @count: Number of blocks to read
+ * @iov: I/O vector describing the data buffers to be filled
+ * @iovcnt: Number of elements in @iov (at most %BLOCK_IOV_MAX)
+ *
+ * Read the content of the @count virtual disk's blocks starting at block
+ * @block and scatter it into the buffers described by @iov, whose lengths must
+ * add up to exactly @count * %BLOCK_SIZE bytes, using a single positional
+ * system call whenever possible.
+ *
+ * Return: -1 if the block range is out of bounds or inaccessible, if the I/O
+ * vector does not cover the range, or if the reading operation fails. 0
+ * otherwise.
+ */
+int block_readv(size_t block, size_t count, const struct iovec *iov,
+		int iovcnt);
+
+/**
+ * block_submit - Perform a batch of block requests
+ * @reqs: Array of requests
+ * @nreqs: Number of requests in @reqs
+ *
+ * Perform every request of @reqs, each one reading or writing a range of
+ * contiguous blocks. With the %BLOCK_BACKEND_FILE backend, requests are
+ * submitted together through io_uring so that the disk works on all of them at
+ * once, and the function returns when all of them have completed. Each thread
+ * submits through its own io_uring instance, so that threads can submit batches
+ * at the same time. If io_uring is not available, requests are performed one
+ * after the other with positional system calls. Requests of a same batch must
+ * not overlap.
+ *
+ * Return: -1 if a block range is out of bounds or inaccessible, or if a request
+ * fails. 0 otherwise.
+ */
+int block_submit(const struct disk_request *reqs, int nreqs);
+
+/**
+ * block_sync - Make the blocks written so far durable
+ *
+ * Wait until every block written to the virtual disk so far has reached stable
+ * storage, so that it survives a crash of the system.
+ *
+ * Return: -1 if no disk is currently open, or if the blocks cannot be synced.
+ * 0 otherwise.
+ */
+int block_sync(void);
+
+/**
+ * block_ptr - Get direct access to a block
+ * @block: Index of the block
+ *
+ * Get a pointer to the content of virtual disk's block @block (%BLOCK_SIZE
+ * bytes), so that it can be read or modified without being copied. Only
+ * available with the %BLOCK_BACKEND_MMAP backend. The pointer becomes invalid
+ * when the disk is closed.
+ *
+ * Return: NULL if the disk is not memory-mapped or if @block is out of bounds.
+ * Otherwise, a pointer to the block's content.
+ */
+void *block_ptr(size_t block);
+
 #endif /* _DISK_H */
 
@@ -1,15 +1,38 @@
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "async.h"
+#include "cache.h"
 #include "disk.h"
-#include "disk.c"
 #include "fs.h"
-#define FAT_EOC 0xFFFF
-#define FS_NUM_FAT_ENTRIES 2048
+#include "stats.h"
+#define FAT_EOC 0xFFFFFFFF
+// end of chain as stored in the 16-bit fat entries of the original format
+#define FAT16_EOC 0xFFFF
+// format version of the disks with 32-bit fat entries and their own block size
+#define FS_FORMAT_EXTENDED 2
 #define SIGNATURE 6000536558536704837
+#define FS_ROOT_HASH_SIZE 256
+// file locks shared by the root directory entries, entry i uses lock i % FS_FILE_LOCK_COUNT
+#define FS_FILE_LOCK_COUNT 128
+// set in the first entry of a root directory block when a file whose home is
+// this block had to be put in a following one, because it was full
+#define ROOT_BLOCK_OVERFLOWED 0x01
+#define FS_ASYNC_THREADS 4
+#define FS_READAHEAD_MIN_BLOCKS 4
+#define FS_READAHEAD_MAX_BLOCKS 64
+// allocations of at most this many blocks take the next free block, see NextFreeLocation()
+#define FS_SMALL_ALLOCATION_BLOCKS 4
+// one list of free runs per power of two of their length
+#define FS_FREE_RUN_LISTS 32
+// runs looked at in the list of the wanted length before trying the longer ones
+#define FS_FREE_RUN_SCAN 16
+#define JOURNAL_SIGNATURE 0x4C4E524A
 
 
 
@@ -18,6 +41,12 @@ enum{
 	MOUNTED
 };
 
+// kinds of journal records
+enum{
+	FAT_RECORD = 1,
+	ROOT_RECORD
+};
+
 typedef struct __attribute__((packed)){
 		uint64_t Signature;
 		int16_t numOfBlocks;
@@ -25,575 +54,2833 @@ typedef struct __attribute__((packed)){
 		int16_t indexOfStartBlock;
 		int16_t numOfDataBlock;
 		int8_t numOfFatBlock;
-		int8_t unused[4079];
+		// metadata journal, all zero on disks formatted without one
+		uint32_t journalSignature;
+		uint16_t indexOfJournalBlock;
+		uint16_t numOfJournalBlock;
+		// sequence number of the first journal block since the last checkpoint
+		uint64_t journalSequence;
+		// extended format, all zero on disks in the original format
+		// the counts above are then zero, and these are used instead
+		uint32_t formatVersion;
+		uint32_t sizeOfBlock;
+		uint32_t numOfBlocksExt;
+		uint32_t indexOfRootDirectoryExt;
+		uint32_t indexOfStartBlockExt;
+		uint32_t numOfDataBlockExt;
+		uint32_t numOfFatBlockExt;
+		uint32_t indexOfJournalBlockExt;
+		uint32_t numOfJournalBlockExt;
+		// 0 on disks formatted before the root directory could span several blocks
+		uint32_t numOfRootBlockExt;
+		int8_t unused[4023];
 }SuperBlock;
 
+// journal blocks start with this header, followed by the records
+// each record is a type, an index, then the new fat entry or root directory entry
+typedef struct __attribute__((packed)){
+		uint64_t sequence;
+		uint32_t checksum;
+		uint16_t sizeOfRecords;
+		// last block of a transaction
+		int8_t isCommit;
+		int8_t unused;
+}JournalHeader;
+
 typedef struct __attribute__((packed)){
 		char filename[FS_FILENAME_LEN];
 		int32_t sizeOfFile;
 		uint16_t indexOfFirstBlock;
-		int8_t unused[10];
+		// upper half of the first block in the extended format
+		uint16_t indexOfFirstBlockHigh;
+		// ROOT_BLOCK_OVERFLOWED, only in the first entry of a block
+		uint8_t rootBlockFlags;
+		int8_t unused[7];
 }RootDirectory;
 
-typedef struct __attribute((packed)){
-		uint16_t* fat;
+typedef struct{
+		// block as stored on disk, 16-bit or 32-bit entries depending on the format,
+		// only accessed through ReadFatValue() and WriteFatValue()
+		void* fat;
+		// modified since it was last written to disk
+		int isDirty;
 }FATBlock;
 
-typedef struct __attribute__((packed)){
+typedef struct{
+		// root directory entry of the open file, NULL if the fd is unused
+		RootDirectory *file;
+		int indexOfRootDirectory;
+		uint64_t offset;
+		// data blocks of the file in order, decoded from the FAT on first use
+		uint32_t *chain;
+		int chainLength;
+		int chainCapacity;
+		int isChainValid;
+		// offset where the next read starts if the fd is read sequentially
+		uint64_t sequentialOffset;
+		// blocks read ahead by the last prefetch, grows while reads are sequential
+		int readaheadBlocks;
+		// first block of the file that was not read ahead yet
+		int readaheadEnd;
+		// held while the fd is used, protects the fields above but the chain
+		pthread_mutex_t lock;
+		// bounce buffer for the blocks that are only partially read or written
+		char *scratchBlock;
+}OpenFile;
+
+// in-memory state only, so no need to pack it like the on-disk structures
+typedef struct fs{
+		disk_t *disk;
+		// data blocks go through the write-back block cache
+		cache_t *cache;
+		// worker threads running the asynchronous reads and writes
+		async_t *async;
 		SuperBlock *superBlock;
+		// layout of the disk, read from the superblock in either format
+		int sizeOfBlock;
+		int numOfBlocks;
+		int indexOfRootDirectory;
+		int numOfRootBlock;
+		int indexOfStartBlock;
+		int numOfDataBlock;
+		int numOfFatBlock;
+		int indexOfJournalBlock;
+		int numOfJournalBlock;
+		// 2 bytes in the original format, 4 in the extended one
+		int sizeOfFatEntry;
+		int numOfFatEntries;
+		int numOfRootEntries;
+		// the scratch blocks of the fds, and a block of zeros to fill the gaps
+		// left by fs_truncate
+		char *scratchBlocks;
+		char *zeroBlock;
 		FATBlock *fatBlocks;
+		// every root directory block, each read the first time a lookup needs it
 		RootDirectory *RootDirectory;
+		int8_t *isRootBlockLoaded;
+		// counts the blocks not read yet as unused
 		int numOfUnusedRootDirectory;
+		int numOfUnusedDataBlock;
+		// one bit per root directory block modified since it was last written to disk
+		uint64_t *dirtyRootBitmap;
 		int isMounted;
-		char* fdWithFileName[FS_OPEN_MAX_COUNT];
-		uint64_t fdWithOffset[FS_OPEN_MAX_COUNT];
+		OpenFile openFiles[FS_OPEN_MAX_COUNT];
+		// number of fds open on each root directory entry
+		int *numOfOpenFds;
+		// one bit per fd, set when the fd is unused
+		uint64_t freeFdBitmap;
 		int numOfOpenFiles;
+		int diskBackend;
+		int fatLoading;
+		// largest readahead window, 0 when there is no cache to read ahead into
+		int maxReadahead;
+		// one bit per data block, set when the block is free
+		uint64_t *freeBlockBitmap;
+		// where the search for the next free block starts
+		int freeBlockCursor;
+		int numOfLoadedFatBlock;
+		// runs of free blocks of the loaded fat blocks, list i holds the runs of
+		// 2^i to 2^(i+1) - 1 blocks and bit i is set when it is not empty
+		int32_t freeRunLists[FS_FREE_RUN_LISTS];
+		uint32_t nonEmptyFreeRunLists;
+		// the first and the last block of a run each hold the index of the other
+		int32_t *freeRunOther;
+		// links of the runs of a same list, by first block
+		int32_t *freeRunNext;
+		int32_t *freeRunPrev;
+		// filename hash index over the loaded root directory blocks, chained by entry
+		int numOfRootHashBuckets;
+		int32_t *rootHashBuckets;
+		int32_t *rootHashNext;
+		// one bit per root directory entry, set when the entry is unused
+		uint64_t *freeRootBitmap;
+		// one bit per fd open on each root directory entry
+		uint64_t *fdsOfFile;
+		// metadata updates are committed to the journal if the disk has one
+		int isJournaled;
+		// next journal block to write since the last checkpoint
+		int journalPosition;
+		// blocks of the commit being written
+		char *journalBuffer;
+		// fat and root directory entries modified since the last commit
+		uint64_t *journalFatBitmap;
+		uint64_t *journalRootBitmap;
+		// set once data blocks are written, cleared by the commit that makes them durable
+		int isDataWritten;
+		// locks are always taken in this order: commit, fd, file, journal, FAT, root directory,
+		// then either root block loading or fd table
+		// one commit at a time, the updates made meanwhile go in the next one
+		pthread_mutex_t commitLock;
+		// held for reading by metadata updates, for writing to snapshot them
+		pthread_rwlock_t journalLock;
+		// content, size, FAT chain and open fds of each file, see FileLock()
+		pthread_rwlock_t fileLocks[FS_FILE_LOCK_COUNT];
+		// fat blocks, free block bitmap and free block count
+		pthread_mutex_t fatLock;
+		// root directory entries and their index, held for writing to add or remove a file
+		// or to modify an entry, for reading to look files up and to open or close them
+		pthread_rwlock_t rootLock;
+		// reading a root directory block and indexing its files, with the root directory
+		// locked for reading, readers only follow the blocks flagged as loaded
+		pthread_mutex_t rootLoadLock;
+		// the fd table and the number of fds open on each file, with the root directory
+		// locked for reading, so that delete sees no fd being opened meanwhile
+		pthread_mutex_t fdTableLock;
 }FileSystem;
 
-FileSystem *fs;
+// file system mounted with fs_mount(), used by the functions without a handle
+static FileSystem *defaultFs;
 
+// number of blocks given to the block cache by the next fs_mount
+static size_t cacheSizeOfNextMount = FS_CACHE_DEFAULT_BLOCKS;
+// how the next fs_mount accesses the virtual disk
+static int diskBackendOfNextMount = FS_DISK_FILE;
+// when the next fs_mount reads the fat blocks
+static int fatLoadingOfNextMount = FS_FAT_EAGER;
+// number of journal blocks reserved by the next fs_mount, if the disk has no journal
+static size_t journalSizeOfNextMount = 0;
+// file the next fs_mount records its block accesses to, if any
+static char *traceFileOfNextMount = NULL;
 
+void FindFatNextLocation(FileSystem *fs, int location, int *indexOfBlock, int *indexInBlock){
+		*indexOfBlock = location / fs->numOfFatEntries;
+		*indexInBlock = location - fs->numOfFatEntries * *indexOfBlock;
+}
 
-int fs_mount(const char *diskname)
-{
-	fs = (FileSystem*)malloc(sizeof(FileSystem));
-	// check if the disk can be open or not
-	if(block_disk_open(diskname) == -1){
-			return -1;
-	}
-	// get the number of block and check if the number is correct
-	int numOfBlocks = block_disk_count();
-	if(numOfBlocks == -1){
-			return -1;
-	}
-	fs->superBlock = (SuperBlock*)malloc(sizeof(SuperBlock));
-	// read the superblock from disk
-	if(block_read(0, fs->superBlock)){
-			return -1;
-	}
-	// check the signature of the file system correspond 
-	// to the one defined by the specifications
-	if (fs->superBlock->Signature != SIGNATURE){
-			return -1;
-	}
-	int numOfFatBlock = fs->superBlock->numOfFatBlock;
-	// check if number of block is correct
-	// total # of block = # of fat + # of data + superblock + rootdirectory
-	if(numOfBlocks != fs->superBlock->numOfFatBlock + fs->superBlock->numOfDataBlock + 2){
-			return -1;
-	}
-	fs->fatBlocks = (FATBlock*)malloc(sizeof(FATBlock) * numOfFatBlock);
-	// read all the fat blocks
-	for(int i = 0; i < numOfFatBlock; i++){
-			fs->fatBlocks[i].fat = (uint16_t*)malloc(sizeof(uint16_t) * BLOCK_SIZE);
-			block_read(i + 1, fs->fatBlocks[i].fat);
-	}
-	fs->RootDirectory = (RootDirectory*)malloc(sizeof(RootDirectory) * FS_FILE_MAX_COUNT);
-	// read the root directory
-	block_read(fs->superBlock->indexOfRootDirectory, fs->RootDirectory);
-	// printf("%s   %s", fs->RootDirectory[3].filename, fs->RootDirectory[1].filename);
-	// check the number of unused root directory (# of unused file)
-	fs->numOfUnusedRootDirectory = FS_FILE_MAX_COUNT;
-	for(int i = 0; i < FS_FILE_MAX_COUNT; i++){
-			// if file name is not empty, discount 1 from 32
-			if(strcmp(fs->RootDirectory[i].filename, "\0") != 0){
-					fs->numOfUnusedRootDirectory -= 1;
-			}
-	}
-	fs->isMounted = MOUNTED;
-	// allocate memory for saving the file name
-	for(int i = 0; i < FS_OPEN_MAX_COUNT; i++){
-			fs->fdWithFileName[i] = (char*)malloc(sizeof(char) * FS_FILENAME_LEN);
-	}
-	return 0;
+uint32_t ReadFatValue(FileSystem *fs, const void *fat, int indexInBlock){
+		// decode an entry as stored on disk, end of chain is FAT_EOC in both formats
+		if(fs->sizeOfFatEntry == sizeof(uint32_t)){
+				return ((const uint32_t*)fat)[indexInBlock];
+		}
+		uint16_t value = ((const uint16_t*)fat)[indexInBlock];
+		return value == FAT16_EOC ? FAT_EOC : value;
 }
 
-int fs_umount(void)
-{
-		// write root directory into disk
-		block_write(fs->superBlock->indexOfRootDirectory, fs->RootDirectory);
-		// write fat block into disk
-		for(int i = 0; i < fs->superBlock->numOfFatBlock; i++){
-				block_write(i + 1, fs->fatBlocks[i].fat);
+void WriteFatValue(FileSystem *fs, void *fat, int indexInBlock, uint32_t value){
+		if(fs->sizeOfFatEntry == sizeof(uint32_t)){
+				((uint32_t*)fat)[indexInBlock] = value;
+		}else{
+				((uint16_t*)fat)[indexInBlock] = value;
 		}
-		fs->isMounted = UNMOUNTED;
-		// free data structure: filesystem, fatblock, RootDirectory
-		// char* fdWithFileName[FS_OPEN_MAX_COUNT], superBlock
-		for(int i = 0; i < fs->superBlock->numOfFatBlock; i++){
-				free(fs->fatBlocks[i].fat);
+}
+
+int IsFreeLocation(FileSystem *fs, int location){
+		return (fs->freeBlockBitmap[location / 64] >> (location % 64)) & 1;
+}
+
+int FreeRunList(int length){
+		return 31 - __builtin_clz(length);
+}
+
+void AddFreeRun(FileSystem *fs, int start, int end){
+		int list = FreeRunList(end - start + 1);
+		fs->freeRunOther[start] = end;
+		fs->freeRunOther[end] = start;
+		fs->freeRunPrev[start] = -1;
+		fs->freeRunNext[start] = fs->freeRunLists[list];
+		if(fs->freeRunLists[list] != -1){
+				fs->freeRunPrev[fs->freeRunLists[list]] = start;
 		}
-		free(fs->superBlock);
-		free(fs->fatBlocks);
-		free(fs->RootDirectory);
-		for(int i = 0; i < FS_OPEN_MAX_COUNT; i++){
-				free(fs->fdWithFileName[i]);
+		fs->freeRunLists[list] = start;
+		fs->nonEmptyFreeRunLists |= (uint32_t)1 << list;
+}
+
+void RemoveFreeRun(FileSystem *fs, int start){
+		int list = FreeRunList(fs->freeRunOther[start] - start + 1);
+		int prev = fs->freeRunPrev[start];
+		int next = fs->freeRunNext[start];
+		if(prev == -1){
+				fs->freeRunLists[list] = next;
+		}else{
+				fs->freeRunNext[prev] = next;
+		}
+		if(next != -1){
+				fs->freeRunPrev[next] = prev;
+		}
+		if(fs->freeRunLists[list] == -1){
+				fs->nonEmptyFreeRunLists &= ~((uint32_t)1 << list);
 		}
-		free(fs);
-		return 0;
 }
 
-int CheckUnusedFat(){
-		if(fs->superBlock->numOfFatBlock == 0){
-				return -1;
+int StartOfFreeRun(FileSystem *fs, int location){
+		// first block of the run holding free block location: one past the
+		// closest used block before it, one 64-block word at a time
+		int indexOfWord = location / 64;
+		uint64_t word = ~fs->freeBlockBitmap[indexOfWord] & (~(uint64_t)0 >> (63 - location % 64));
+		while(word == 0){
+				indexOfWord -= 1;
+				if(indexOfWord < 0){
+						return 0;
+				}
+				word = ~fs->freeBlockBitmap[indexOfWord];
 		}
-		// get the number of fat block and check number of used fat block
-		int numOfFat = fs->superBlock->numOfFatBlock;
-		int count = 0;
-		for(int i = 0; i < numOfFat; i++){
-				for(int j = 0; j < FS_NUM_FAT_ENTRIES; j++){
-						if(fs->fatBlocks[i].fat[j] != 0){
-								count += 1;
-						}
+		return indexOfWord * 64 + 64 - __builtin_clzll(word);
+}
+
+void MarkFatLocation(FileSystem *fs, int location, int isFree){
+		// also count the free data blocks, so fs_info does not scan the FAT
+		// and keep the runs of free blocks, merged with their neighbours
+		uint64_t bit = (uint64_t)1 << (location % 64);
+		int wasFree = (fs->freeBlockBitmap[location / 64] & bit) != 0;
+		if(isFree == wasFree){
+				return;
+		}
+		if(isFree){
+				int start = location;
+				int end = location;
+				if(location > 0 && IsFreeLocation(fs, location - 1)){
+						start = fs->freeRunOther[location - 1];
+						RemoveFreeRun(fs, start);
+				}
+				if(location + 1 < fs->numOfDataBlock && IsFreeLocation(fs, location + 1)){
+						end = fs->freeRunOther[location + 1];
+						RemoveFreeRun(fs, location + 1);
+				}
+				fs->freeBlockBitmap[location / 64] |= bit;
+				AddFreeRun(fs, start, end);
+		}else{
+				int start = StartOfFreeRun(fs, location);
+				int end = fs->freeRunOther[start];
+				RemoveFreeRun(fs, start);
+				fs->freeBlockBitmap[location / 64] &= ~bit;
+				if(start < location){
+						AddFreeRun(fs, start, location - 1);
+				}
+				if(location < end){
+						AddFreeRun(fs, location + 1, end);
 				}
 		}
-		// # of datablock - # of used fat = # of unused fat
-		return fs->superBlock->numOfDataBlock - count;
+		fs->numOfUnusedDataBlock += isFree - wasFree;
 }
 
-int fs_info(void)
-{
-		// print the file system information based on reference
-		printf("FS Info:\n");
-		printf("total_blk_count=%d\n", fs->superBlock->numOfBlocks);
-		printf("fat_blk_count=%d\n", fs->superBlock->numOfFatBlock);
-		printf("rdir_blk=%d\n", fs->superBlock->indexOfRootDirectory);
-		printf("data_blk=%d\n", fs->superBlock->indexOfStartBlock);
-		printf("data_blk_count=%d\n", fs->superBlock->numOfDataBlock);
-		int numOfUnusedBlock = CheckUnusedFat();
-		printf("fat_free_ratio=%d/%d\n", numOfUnusedBlock, fs->superBlock->numOfDataBlock);
-		printf("rdir_free_ratio=%d/%d\n", fs->numOfUnusedRootDirectory, FS_FILE_MAX_COUNT);
-		return 0;
+uint32_t GetFirstBlock(FileSystem *fs, RootDirectory *file){
+		// the extended format keeps the upper half of the index in unused bytes
+		if(fs->sizeOfFatEntry == sizeof(uint32_t)){
+				return (uint32_t)file->indexOfFirstBlockHigh << 16 | file->indexOfFirstBlock;
+		}
+		return file->indexOfFirstBlock == FAT16_EOC ? FAT_EOC : file->indexOfFirstBlock;
 }
 
-int FileCheck(const char *filename){
-	// check if the file is mounte or not
-	// check if filename is correct(NULL, more than 16 chars, no file name)
-		if(fs->isMounted == UNMOUNTED){
-				return -1;
+void SetFirstBlock(FileSystem *fs, RootDirectory *file, uint32_t value){
+		file->indexOfFirstBlock = value;
+		if(fs->sizeOfFatEntry == sizeof(uint32_t)){
+				file->indexOfFirstBlockHigh = value >> 16;
 		}
-		if(filename == NULL){
-				return -1;
+}
+
+int LoadFatBlock(FileSystem *fs, int indexOfBlock){
+		// read a fat block the first time one of its entries is referenced
+		// and add its free entries to the free block bitmap
+		if(fs->fatBlocks[indexOfBlock].fat != NULL){
+				return 0;
 		}
-		if(strlen(filename) > FS_FILENAME_LEN || strlen(filename) == 0){
+		void *fat = malloc(fs->sizeOfBlock);
+		if(fat == NULL || disk_read(fs->disk, indexOfBlock + 1, fat)){
+				free(fat);
 				return -1;
 		}
+		fs->fatBlocks[indexOfBlock].fat = fat;
+		fs->numOfLoadedFatBlock += 1;
+		int firstEntry = indexOfBlock * fs->numOfFatEntries;
+		int endOfEntries = firstEntry + fs->numOfFatEntries;
+		if(endOfEntries > fs->numOfDataBlock){
+				endOfEntries = fs->numOfDataBlock;
+		}
+		// entry 0 is reserved and never allocated
+		for(int i = firstEntry > 0 ? firstEntry : 1; i < endOfEntries; i++){
+				if(ReadFatValue(fs, fat, i - firstEntry) == 0){
+						MarkFatLocation(fs, i, 1);
+				}
+		}
 		return 0;
 }
 
-int FindFileLocation(const char *filename){
-		// based on filename find the index of entry based on filename
-		for(int i = 0; i < FS_FILE_MAX_COUNT; i++){
-				if(strcmp(filename, fs->RootDirectory[i].filename) == 0){
-						return i;
+int LoadAllFatBlocks(FileSystem *fs){
+		for(int i = 0; i < fs->numOfFatBlock; i++){
+				if(LoadFatBlock(fs, i)){
+						return -1;
 				}
 		}
-		return -1;
+		return 0;
 }
 
-int FindUnusedRootLocation(){
-	// return the first find ununsed root location for file
-	for(int i = 0; i < FS_FILE_MAX_COUNT; i++){
-				if(strlen(fs->RootDirectory[i].filename) == 0){
-						return i;
-				}
+uint32_t GetFatEntry(FileSystem *fs, int location){
+		int indexOfBlock, indexInBlock;
+		FindFatNextLocation(fs, location, &indexOfBlock, &indexInBlock);
+		if(LoadFatBlock(fs, indexOfBlock)){
+				return FAT_EOC;
 		}
-	return -1;
+		return ReadFatValue(fs, fs->fatBlocks[indexOfBlock].fat, indexInBlock);
 }
 
-int fs_create(const char *filename)
-{
-		// check if FS is not mount, filename invalid
-		if(FileCheck((char*)filename) == -1){
+int SetFatEntry(FileSystem *fs, int location, uint32_t value){
+		// every FAT update goes through here to keep the free block index in sync
+		// return -1 if the fat block of the entry cannot be read
+		int indexOfBlock, indexInBlock;
+		FindFatNextLocation(fs, location, &indexOfBlock, &indexInBlock);
+		if(LoadFatBlock(fs, indexOfBlock)){
 				return -1;
 		}
-		// get the root index of this new file
-		// -1 if all root location are used(already have 128 files)
-		int startIndexOfRootDirectory = FindUnusedRootLocation();
-		// check if the filename has been used
-		// check if root directory already contains 128 files
-		if(FindFileLocation(filename) != -1 || startIndexOfRootDirectory == -1){
-				return -1;
+		WriteFatValue(fs, fs->fatBlocks[indexOfBlock].fat, indexInBlock, value);
+		fs->fatBlocks[indexOfBlock].isDirty = 1;
+		MarkFatLocation(fs, location, value == 0);
+		if(fs->journalFatBitmap != NULL){
+				fs->journalFatBitmap[location / 64] |= (uint64_t)1 << (location % 64);
 		}
-		// initialization of new file
-		strcpy(fs->RootDirectory[startIndexOfRootDirectory].filename, filename);
-		fs->RootDirectory[startIndexOfRootDirectory].sizeOfFile = 0;
-		fs->RootDirectory[startIndexOfRootDirectory].indexOfFirstBlock = FAT_EOC;
-		fs->numOfUnusedRootDirectory -= 1;
 		return 0;
+}
 
+void MarkRootEntryDirty(FileSystem *fs, int indexOfRootDirectory){
+		// called with the root directory locked for writing
+		int indexOfBlock = indexOfRootDirectory / (fs->sizeOfBlock / sizeof(RootDirectory));
+		fs->dirtyRootBitmap[indexOfBlock / 64] |= (uint64_t)1 << (indexOfBlock % 64);
+		fs->journalRootBitmap[indexOfRootDirectory / 64] |= (uint64_t)1 << (indexOfRootDirectory % 64);
 }
 
-void FindFatNextLocation(int location, int *indexOfBlock, int *indexInBlock){
-		*indexOfBlock = location / FS_NUM_FAT_ENTRIES;
-		*indexInBlock = location - FS_NUM_FAT_ENTRIES * *indexOfBlock;
+void BeginMetadataUpdate(FileSystem *fs){
+		// a commit never sees the fat and root directory halfway through an update
+		if(fs->isJournaled){
+				pthread_rwlock_rdlock(&fs->journalLock);
+		}
 }
 
-int fs_delete(const char *filename)
-{
-		// check if FS is not mount, filename invalid
-		if(FileCheck(filename) == -1){
+void EndMetadataUpdate(FileSystem *fs){
+		if(fs->isJournaled){
+				pthread_rwlock_unlock(&fs->journalLock);
+		}
+}
+
+int BuildFreeBlockBitmap(FileSystem *fs){
+		// one FAT entry per data block, spread over all the fat blocks
+		int numOfWords = (fs->numOfDataBlock + 63) / 64;
+		fs->freeBlockBitmap = (uint64_t*)calloc(numOfWords, sizeof(uint64_t));
+		// only the ends of the runs are ever read
+		fs->freeRunOther = (int32_t*)malloc(sizeof(int32_t) * fs->numOfDataBlock);
+		fs->freeRunNext = (int32_t*)malloc(sizeof(int32_t) * fs->numOfDataBlock);
+		fs->freeRunPrev = (int32_t*)malloc(sizeof(int32_t) * fs->numOfDataBlock);
+		if(fs->freeBlockBitmap == NULL || fs->freeRunOther == NULL || fs->freeRunNext == NULL || fs->freeRunPrev == NULL){
 				return -1;
 		}
-		// check if file not exist
-		int indexOfRootDirectory = FindFileLocation(filename);
-		if(indexOfRootDirectory == -1){
+		for(int i = 0; i < FS_FREE_RUN_LISTS; i++){
+				fs->freeRunLists[i] = -1;
+		}
+		fs->freeBlockCursor = 1;
+		// in lazy mode, each fat block adds its entries when it is loaded
+		if(fs->fatLoading == FS_FAT_LAZY){
+				return 0;
+		}
+		return LoadAllFatBlocks(fs);
+}
+
+int NextFatLocation(FileSystem *fs, int location, int isFree){
+		// first location from here that is free (or used), one 64-block word at a time
+		// return -1 if a fat block cannot be read
+		int numOfDataBlock = fs->numOfDataBlock;
+		if(location >= numOfDataBlock){
+				return numOfDataBlock;
+		}
+		int indexOfWord = location / 64;
+		uint64_t invert = isFree ? 0 : ~(uint64_t)0;
+		// the bits of a word are only known once its fat block is loaded
+		if(LoadFatBlock(fs, indexOfWord * 64 / fs->numOfFatEntries)){
 				return -1;
 		}
-		// need to check if file is open
-		// if the file is open, return -1
-		for (int i = 0; i < FS_OPEN_MAX_COUNT; i++){
-				if(strcmp(filename, fs->fdWithFileName[i]) == 0){
+		uint64_t word = (fs->freeBlockBitmap[indexOfWord] ^ invert) & (~(uint64_t)0 << (location % 64));
+		while(word == 0){
+				indexOfWord += 1;
+				if(indexOfWord * 64 >= numOfDataBlock){
+						return numOfDataBlock;
+				}
+				if(LoadFatBlock(fs, indexOfWord * 64 / fs->numOfFatEntries)){
 						return -1;
 				}
+				word = fs->freeBlockBitmap[indexOfWord] ^ invert;
 		}
-		// set the size of file to 0
-		fs->RootDirectory[indexOfRootDirectory].sizeOfFile = 0;
-		// clean the filename inside root directory
-		for(int i = 0; i < FS_FILENAME_LEN; i++){
-				strcpy(fs->RootDirectory[indexOfRootDirectory].filename + i, "\0");
-		}
-		int16_t indexOfCurrentFat = fs->RootDirectory[indexOfRootDirectory].indexOfFirstBlock;
-		int* indexOfBlock = (int*)malloc(sizeof(int));
-		int* indexInBlock = (int*)malloc(sizeof(int));
-		// get the fat index
-		FindFatNextLocation(indexOfCurrentFat, indexOfBlock, indexInBlock);
-		uint16_t* currentFat = (uint16_t*)malloc(sizeof(uint16_t));
-		currentFat = &(fs->fatBlocks[*indexOfBlock].fat[*indexInBlock]);
-		uint16_t* nextFat = (uint16_t*)malloc(sizeof(uint16_t));
-		// set the fat block belong to this file to 0
-		while(*currentFat != FAT_EOC){
-				FindFatNextLocation(*currentFat, indexOfBlock, indexInBlock);
-				nextFat = &(fs->fatBlocks[*indexOfBlock].fat[*indexInBlock]);
-				*currentFat = 0;
-				currentFat = nextFat;
-		}
-		currentFat = 0;
-		fs->RootDirectory[indexOfRootDirectory].indexOfFirstBlock = FAT_EOC;
-		fs->numOfUnusedRootDirectory += 1;
-		return 0;
+		location = indexOfWord * 64 + __builtin_ctzll(word);
+		return location < numOfDataBlock ? location : numOfDataBlock;
 }
 
-int fs_ls(void)
-{
-		if(fs->isMounted == UNMOUNTED){
+int FindFreeRun(FileSystem *fs, int numOfBlocks, int *lengthOfRun){
+		// good fit over the runs of the loaded fat blocks: a run long enough among
+		// the first ones of its list, otherwise one of the first non-empty list of
+		// longer runs, otherwise the longest run seen, if every fat block is loaded
+		// return -1 if no run was found
+		int list = FreeRunList(numOfBlocks);
+		int scanned = 0;
+		for(int start = fs->freeRunLists[list]; start != -1 && scanned < FS_FREE_RUN_SCAN; start = fs->freeRunNext[start]){
+				if(fs->freeRunOther[start] - start + 1 >= numOfBlocks){
+						*lengthOfRun = numOfBlocks;
+						return start;
+				}
+				scanned += 1;
+		}
+		uint32_t longerLists = fs->nonEmptyFreeRunLists & (~(uint32_t)0 << list << 1);
+		if(longerLists != 0){
+				*lengthOfRun = numOfBlocks;
+				return fs->freeRunLists[__builtin_ctz(longerLists)];
+		}
+		// in lazy mode, the fat blocks not loaded yet may have longer runs
+		if(fs->nonEmptyFreeRunLists == 0 || fs->numOfLoadedFatBlock < fs->numOfFatBlock){
 				return -1;
 		}
-		printf("FS Ls:\n");
-		for(int i = 0; i < FS_FILE_MAX_COUNT; i++){
-				if(strlen(fs->RootDirectory[i].filename) != 0){
-						printf("file: %s, ", fs->RootDirectory[i].filename);
-						printf("size: %d, ", fs->RootDirectory[i].sizeOfFile);
-						printf("data_blk: %d\n",  fs->RootDirectory[i].indexOfFirstBlock);
+		list = 31 - __builtin_clz(fs->nonEmptyFreeRunLists);
+		int bestStart = fs->freeRunLists[list];
+		scanned = 0;
+		for(int start = bestStart; start != -1 && scanned < FS_FREE_RUN_SCAN; start = fs->freeRunNext[start]){
+				if(fs->freeRunOther[start] - start > fs->freeRunOther[bestStart] - bestStart){
+						bestStart = start;
 				}
+				scanned += 1;
 		}
-		return 0;
+		*lengthOfRun = fs->freeRunOther[bestStart] - bestStart + 1;
+		return bestStart;
 }
 
-int fs_open(const char *filename)
-{
-		if(FileCheck(filename) == -1){
+int NextFreeLocation(FileSystem *fs){
+		// next fit from where the last search stopped, wrapping around once
+		// return -1 if the disk is full, -2 if a fat block cannot be read
+		if(fs->numOfUnusedDataBlock == 0 && fs->numOfLoadedFatBlock == fs->numOfFatBlock){
 				return -1;
 		}
-		int indexOfFile = FindFileLocation(filename);
-		if(indexOfFile == -1){
-				return -1;
+		int location = NextFatLocation(fs, fs->freeBlockCursor, 1);
+		if(location == fs->numOfDataBlock){
+				location = NextFatLocation(fs, 1, 1);
+		}
+		if(location == -1){
+				return -2;
 		}
-		if(fs->numOfOpenFiles == FS_OPEN_MAX_COUNT){
+		if(location == fs->numOfDataBlock){
 				return -1;
 		}
-		// set corrosponding offset to 0
-		fs->numOfOpenFiles += 1;
-		for(int i = 0; i < FS_OPEN_MAX_COUNT; i++){
-			
-				if(strlen(fs->fdWithFileName[i]) == 0){
-						strcpy(fs->fdWithFileName[i], filename);
-						fs->fdWithOffset[i] = 0;
-						return i;
+		fs->freeBlockCursor = location;
+		return location;
+}
+
+unsigned int HashFilename(const char *filename){
+		// FNV-1a over the (at most FS_FILENAME_LEN long) filename
+		// also picks the home block of the file, so it must never change
+		unsigned int hash = 2166136261u;
+		for(int i = 0; i < FS_FILENAME_LEN && filename[i] != '\0'; i++){
+				hash = (hash ^ (unsigned char)filename[i]) * 16777619u;
+		}
+		return hash;
+}
+
+void AddFileToIndex(FileSystem *fs, int indexOfRootDirectory){
+		unsigned int hash = HashFilename(fs->RootDirectory[indexOfRootDirectory].filename) % fs->numOfRootHashBuckets;
+		fs->rootHashNext[indexOfRootDirectory] = fs->rootHashBuckets[hash];
+		// lookups may follow the chain meanwhile if a root block is being loaded
+		__atomic_store_n(&fs->rootHashBuckets[hash], indexOfRootDirectory, __ATOMIC_RELEASE);
+		fs->freeRootBitmap[indexOfRootDirectory / 64] &= ~((uint64_t)1 << (indexOfRootDirectory % 64));
+		fs->numOfUnusedRootDirectory -= 1;
+}
+
+void RemoveFileFromIndex(FileSystem *fs, int indexOfRootDirectory){
+		// must be called while the entry still holds its filename
+		unsigned int hash = HashFilename(fs->RootDirectory[indexOfRootDirectory].filename) % fs->numOfRootHashBuckets;
+		if(fs->rootHashBuckets[hash] == indexOfRootDirectory){
+				fs->rootHashBuckets[hash] = fs->rootHashNext[indexOfRootDirectory];
+		}else{
+				int i = fs->rootHashBuckets[hash];
+				while(fs->rootHashNext[i] != indexOfRootDirectory){
+						i = fs->rootHashNext[i];
 				}
+				fs->rootHashNext[i] = fs->rootHashNext[indexOfRootDirectory];
 		}
-		return -1;
+		fs->freeRootBitmap[indexOfRootDirectory / 64] |= (uint64_t)1 << (indexOfRootDirectory % 64);
+		fs->numOfUnusedRootDirectory += 1;
 }
 
-int FdCheck(int fd){
-		if(fs->isMounted == UNMOUNTED){
-				return -1;
+int AllocateRootDirectory(FileSystem *fs){
+		// start with every entry unused, then each block read adds the ones holding a file
+		int numOfRootEntries = fs->numOfRootEntries;
+		int numOfWords = numOfRootEntries / 64;
+		fs->numOfRootHashBuckets = FS_ROOT_HASH_SIZE;
+		while(fs->numOfRootHashBuckets < numOfRootEntries){
+				fs->numOfRootHashBuckets *= 2;
 		}
-		if(fd > FS_OPEN_MAX_COUNT){
+		fs->RootDirectory = (RootDirectory*)calloc(fs->numOfRootBlock, fs->sizeOfBlock);
+		fs->isRootBlockLoaded = (int8_t*)calloc(fs->numOfRootBlock, sizeof(int8_t));
+		fs->dirtyRootBitmap = (uint64_t*)calloc((fs->numOfRootBlock + 63) / 64, sizeof(uint64_t));
+		fs->rootHashBuckets = (int32_t*)malloc(sizeof(int32_t) * fs->numOfRootHashBuckets);
+		fs->rootHashNext = (int32_t*)malloc(sizeof(int32_t) * numOfRootEntries);
+		fs->freeRootBitmap = (uint64_t*)malloc(sizeof(uint64_t) * numOfWords);
+		fs->journalRootBitmap = (uint64_t*)calloc(numOfWords, sizeof(uint64_t));
+		fs->numOfOpenFds = (int*)calloc(numOfRootEntries, sizeof(int));
+		fs->fdsOfFile = (uint64_t*)calloc(numOfRootEntries, sizeof(uint64_t));
+		if(fs->RootDirectory == NULL || fs->isRootBlockLoaded == NULL || fs->dirtyRootBitmap == NULL
+				|| fs->rootHashBuckets == NULL || fs->rootHashNext == NULL || fs->freeRootBitmap == NULL
+				|| fs->journalRootBitmap == NULL || fs->numOfOpenFds == NULL || fs->fdsOfFile == NULL){
 				return -1;
 		}
-		if(strlen(fs->fdWithFileName[fd]) == 0){
-				return -1;
+		for(int i = 0; i < fs->numOfRootHashBuckets; i++){
+				fs->rootHashBuckets[i] = -1;
 		}
+		for(int i = 0; i < numOfWords; i++){
+				fs->freeRootBitmap[i] = ~(uint64_t)0;
+		}
+		fs->numOfUnusedRootDirectory = numOfRootEntries;
 		return 0;
 }
 
-int fs_close(int fd)
-{
-	// check fd
-	// (including check if fs is mount, fd>32, file not exist)
-	if(FdCheck(fd) == -1){
-		return -1;
-	}
-	// set offset to 0. name to empty, number of exist file -1
-	strcpy(fs->fdWithFileName[fd], "");
-	fs->fdWithOffset[fd] = 0;
-	fs->numOfOpenFiles -= 1;
-	return 0;
+int LoadRootBlock(FileSystem *fs, int indexOfBlock){
+		// called with the root directory locked for reading or writing
+		// read a root directory block the first time a lookup reaches it
+		// and index the files it holds, then flag it as loaded
+		if(__atomic_load_n(&fs->isRootBlockLoaded[indexOfBlock], __ATOMIC_ACQUIRE)){
+				return 0;
+		}
+		pthread_mutex_lock(&fs->rootLoadLock);
+		int ret = 0;
+		if(!fs->isRootBlockLoaded[indexOfBlock]){
+				int numOfEntries = fs->sizeOfBlock / sizeof(RootDirectory);
+				int firstEntry = indexOfBlock * numOfEntries;
+				ret = disk_read(fs->disk, fs->indexOfRootDirectory + indexOfBlock, &fs->RootDirectory[firstEntry]);
+				for(int i = firstEntry; i < firstEntry + numOfEntries && ret == 0; i++){
+						if(fs->RootDirectory[i].filename[0] != '\0'){
+								AddFileToIndex(fs, i);
+						}
+				}
+				if(ret == 0){
+						__atomic_store_n(&fs->isRootBlockLoaded[indexOfBlock], 1, __ATOMIC_RELEASE);
+				}
+		}
+		pthread_mutex_unlock(&fs->rootLoadLock);
+		return ret ? -1 : 0;
 }
 
-int fs_stat(int fd)
-{
-	if(FdCheck(fd) == -1){
-		return -1;
-	}
-	// get the filename based on fd
-	char filename[FS_FILENAME_LEN];
-	strcpy(filename, fs->fdWithFileName[fd]);
-	const char* constFilename = filename;
-	// find file's place in root diractory
-	// if not find return -1
-	int indexOfFile = FindFileLocation(constFilename);
-	if(indexOfFile == -1){
-		return -1;
-	}
-	// if find, return the size of file
-	return fs->RootDirectory[indexOfFile].sizeOfFile;
+int LoadAllRootBlocks(FileSystem *fs){
+		for(int i = 0; i < fs->numOfRootBlock; i++){
+				if(LoadRootBlock(fs, i)){
+						return -1;
+				}
+		}
+		return 0;
 }
 
-int fs_lseek(int fd, size_t offset)
-{
-	if(FdCheck(fd) == -1){
-		return -1;
-	}
-	size_t checkSize = fs_stat(fd);
-	// offset cannot be larger than the file size
-	if(checkSize < offset){
-		return -1;
-	}
-	// move to the new offset
-	fs->fdWithOffset[fd] = offset;
-	return 0;
+pthread_rwlock_t *FileLock(FileSystem *fs, int indexOfRootDirectory){
+		// files share a few locks, a thread never holds two of them
+		return &fs->fileLocks[indexOfRootDirectory % FS_FILE_LOCK_COUNT];
 }
 
-int FindUnusedFatLocation(){
-	int* indexOfBlock = (int*)malloc(sizeof(int));
-	int* indexInBlock = (int*)malloc(sizeof(int));
-	for(int i = 1; i < FS_NUM_FAT_ENTRIES; i++){
-		FindFatNextLocation(i, indexOfBlock, indexInBlock);
-		uint16_t currentFat = fs->fatBlocks[*indexOfBlock].fat[*indexInBlock];
-		if(currentFat == 0){
-			free(indexInBlock);
-			free(indexOfBlock);
-			return i;
+void InitLocks(FileSystem *fs){
+		for(int i = 0; i < FS_OPEN_MAX_COUNT; i++){
+				pthread_mutex_init(&fs->openFiles[i].lock, NULL);
 		}
-	}
-	return -1;
-	
+		for(int i = 0; i < FS_FILE_LOCK_COUNT; i++){
+				pthread_rwlock_init(&fs->fileLocks[i], NULL);
+		}
+		pthread_mutex_init(&fs->commitLock, NULL);
+		pthread_rwlock_init(&fs->journalLock, NULL);
+		pthread_mutex_init(&fs->fatLock, NULL);
+		pthread_rwlock_init(&fs->rootLock, NULL);
+		pthread_mutex_init(&fs->rootLoadLock, NULL);
+		pthread_mutex_init(&fs->fdTableLock, NULL);
 }
 
+void DestroyLocks(FileSystem *fs){
+		for(int i = 0; i < FS_OPEN_MAX_COUNT; i++){
+				pthread_mutex_destroy(&fs->openFiles[i].lock);
+		}
+		for(int i = 0; i < FS_FILE_LOCK_COUNT; i++){
+				pthread_rwlock_destroy(&fs->fileLocks[i]);
+		}
+		pthread_mutex_destroy(&fs->commitLock);
+		pthread_rwlock_destroy(&fs->journalLock);
+		pthread_mutex_destroy(&fs->fatLock);
+		pthread_rwlock_destroy(&fs->rootLock);
+		pthread_mutex_destroy(&fs->rootLoadLock);
+		pthread_mutex_destroy(&fs->fdTableLock);
+}
 
-int fs_write(int fd, void *buf, size_t count)
-{
+void FreeFileSystem(FileSystem *fs){
+		// release whatever was allocated, even by a mount that failed halfway
+		if(fs->fatBlocks != NULL){
+				for(int i = 0; i < fs->numOfFatBlock; i++){
+						free(fs->fatBlocks[i].fat);
+				}
+		}
+		free(fs->superBlock);
+		free(fs->scratchBlocks);
+		free(fs->zeroBlock);
+		free(fs->fatBlocks);
+		free(fs->freeBlockBitmap);
+		free(fs->freeRunOther);
+		free(fs->freeRunNext);
+		free(fs->freeRunPrev);
+		free(fs->RootDirectory);
+		free(fs->isRootBlockLoaded);
+		free(fs->dirtyRootBitmap);
+		free(fs->rootHashBuckets);
+		free(fs->rootHashNext);
+		free(fs->freeRootBitmap);
+		free(fs->numOfOpenFds);
+		free(fs->fdsOfFile);
+		free(fs->journalBuffer);
+		free(fs->journalFatBitmap);
+		free(fs->journalRootBitmap);
+		async_destroy(fs->async);
+		DestroyLocks(fs);
+		free(fs);
+}
 
-		if(FdCheck(fd) == -1){
-				return -1;
+fs_t *MountFailed(FileSystem *fs){
+		if(fs->disk != NULL){
+				disk_close(fs->disk);
 		}
-		if(count == 0){
+		FreeFileSystem(fs);
+		return NULL;
+}
+
+int SyncMetadata(FileSystem *fs){
+		// only write the fat and root directory blocks that were modified
+		// the dirty fat blocks are all submitted to the disk together, then the root directory ones
+		int ret = 0;
+		struct disk_request *requests = (struct disk_request*)malloc(sizeof(struct disk_request) * (fs->numOfFatBlock + fs->numOfRootBlock));
+		if(requests == NULL){
 				return -1;
 		}
-		if(!buf){
-				return -1;
+		int numOfRequests = 0;
+		pthread_mutex_lock(&fs->fatLock);
+		for(int i = 0; i < fs->numOfFatBlock; i++){
+				// fat blocks never loaded cannot be dirty
+				if(fs->fatBlocks[i].isDirty){
+						requests[numOfRequests].block = i + 1;
+						requests[numOfRequests].count = 1;
+						requests[numOfRequests].buf = fs->fatBlocks[i].fat;
+						requests[numOfRequests].is_write = 1;
+						numOfRequests += 1;
+				}
 		}
-		//set filename
-		char filename[FS_FILENAME_LEN];
-		strcpy(filename, fs->fdWithFileName[fd]);
-		//set offset
-		uint64_t offsetOfFile = fs->fdWithOffset[fd];
-		const char *constFilename = filename;
-		//find RootDirectory by filename
-		int indexOfRootDirectory = FindFileLocation(constFilename);
-		int indexOfUnusedFatBlock;
-		//check whether offset is bigger than file
-		if(fs->fdWithOffset[fd] > (uint64_t)fs->RootDirectory[indexOfRootDirectory].sizeOfFile){
-				return -1;
-		}
-		//number of block need to read from disk
-		int numOfReadTimes = (count + (int)offsetOfFile) / BLOCK_SIZE;
-		size_t checkSize = numOfReadTimes * BLOCK_SIZE;
-		if((count + (int)offsetOfFile) > checkSize){
-				numOfReadTimes += 1;
-				checkSize = (count + (int)offsetOfFile - checkSize) + numOfReadTimes * BLOCK_SIZE;
-		}
-
-		int* indexOfBlock = (int*)malloc(sizeof(int));
-		int* indexInBlock = (int*)malloc(sizeof(int));
-		int remainSize = count;
-		int actualSize = 0;
-		int* actualSizeInEachBlock = (int*)malloc(sizeof(int) * numOfReadTimes);
-		int indexOfFat = fs->RootDirectory[indexOfRootDirectory].indexOfFirstBlock;
-		int startOffsetInBlock = 0;
-		//find index of block and start position in block by offset
-		if(offsetOfFile != 0){
-				int fatOffsetPoint = offsetOfFile / BLOCK_SIZE;
-				indexOfFat = indexOfFat + fatOffsetPoint;
-				startOffsetInBlock = offsetOfFile - (fatOffsetPoint * BLOCK_SIZE);
-				//numOfReadTimes += 1;
-		}
-		void* partOfBuffer = malloc(BLOCK_SIZE);
-		void* bufferStoreLargeBlock = malloc(BLOCK_SIZE * numOfReadTimes);
-		uint16_t* currentFat = (uint16_t*)malloc(sizeof(uint16_t));
-		//read block from disk
-		for(int i = 0; i < numOfReadTimes; i++){
-				if(indexOfFat == -1 || indexOfFat == FAT_EOC){
-						break;
+		if(disk_submit(fs->disk, requests, numOfRequests)){
+				ret = -1;
+		}else{
+				for(int i = 0; i < fs->numOfFatBlock; i++){
+						fs->fatBlocks[i].isDirty = 0;
 				}
-				block_read(fs->superBlock->indexOfStartBlock + indexOfFat , partOfBuffer);
-				FindFatNextLocation(indexOfFat, indexOfBlock, indexInBlock);
-				indexOfFat = fs->fatBlocks[*indexOfBlock].fat[*indexInBlock];
-				if(remainSize > BLOCK_SIZE){
-						memcpy(bufferStoreLargeBlock +  BLOCK_SIZE * i, partOfBuffer, BLOCK_SIZE);
-						actualSize += BLOCK_SIZE;
-						remainSize -= BLOCK_SIZE;
-				}else{
-						memcpy(bufferStoreLargeBlock + BLOCK_SIZE * i, partOfBuffer, BLOCK_SIZE);
-						actualSize += remainSize;
-						remainSize -= remainSize;
-				}
-				
-				
-		}
-		
-		//overwrite block
-		int countOfBlock = 0;
-		int sizeOfDataInBlock = 0;
-		for(int i = 0; (size_t)i < count; i++){
-			
-				memcpy(bufferStoreLargeBlock + startOffsetInBlock + i, buf + i, 1);
-				sizeOfDataInBlock += 1;
-				if((size_t)i == count - 1){
-						actualSizeInEachBlock[countOfBlock] = sizeOfDataInBlock;
-						countOfBlock += 1;
-						sizeOfDataInBlock = 0;
-				}else if ((startOffsetInBlock + i) % BLOCK_SIZE == 0 && (startOffsetInBlock + i) != 0){
-						actualSizeInEachBlock[countOfBlock] = sizeOfDataInBlock;
-						countOfBlock += 1;
-						sizeOfDataInBlock = 0;
-				}
-			
-		}
-		indexOfFat = fs->RootDirectory[indexOfRootDirectory].indexOfFirstBlock;
-		if(offsetOfFile != 0){
-				int fatOffsetPoint = offsetOfFile / BLOCK_SIZE;
-				indexOfFat = indexOfFat + fatOffsetPoint;
-		}
-		
-		if(indexOfFat == FAT_EOC){
-				indexOfUnusedFatBlock = FindUnusedFatLocation();
-				if(indexOfUnusedFatBlock == -1){
-						return 0;
+		}
+		pthread_mutex_unlock(&fs->fatLock);
+		numOfRequests = 0;
+		int numOfEntries = fs->sizeOfBlock / sizeof(RootDirectory);
+		int numOfWords = (fs->numOfRootBlock + 63) / 64;
+		pthread_rwlock_wrlock(&fs->rootLock);
+		for(int i = 0; i < numOfWords; i++){
+				for(uint64_t bits = fs->dirtyRootBitmap[i]; bits != 0; bits &= bits - 1){
+						int indexOfBlock = i * 64 + __builtin_ctzll(bits);
+						requests[numOfRequests].block = fs->indexOfRootDirectory + indexOfBlock;
+						requests[numOfRequests].count = 1;
+						requests[numOfRequests].buf = &fs->RootDirectory[indexOfBlock * numOfEntries];
+						requests[numOfRequests].is_write = 1;
+						numOfRequests += 1;
 				}
-				*currentFat = indexOfUnusedFatBlock;
-				fs->RootDirectory[indexOfRootDirectory].indexOfFirstBlock = *currentFat;
+		}
+		if(disk_submit(fs->disk, requests, numOfRequests)){
+				ret = -1;
 		}else{
-			
-			*currentFat = indexOfFat;
-		}
-		actualSize = 0;
-		//write block back to the disk
-		for(int i = 0; i < numOfReadTimes; i++){
-				memcpy(partOfBuffer, bufferStoreLargeBlock + BLOCK_SIZE * i, BLOCK_SIZE);
-				block_write(fs->superBlock->indexOfStartBlock + *currentFat , partOfBuffer);
-				actualSize += actualSizeInEachBlock[i];
-				if(i == numOfReadTimes - 1){
-					
-						break;
+				memset(fs->dirtyRootBitmap, 0, sizeof(uint64_t) * numOfWords);
+		}
+		pthread_rwlock_unlock(&fs->rootLock);
+		free(requests);
+		return ret;
+}
+
+uint32_t JournalChecksum(const char *block){
+		// FNV-1a over the header and the records, checksum excluded
+		const JournalHeader *header = (const JournalHeader*)block;
+		size_t size = sizeof(JournalHeader) + header->sizeOfRecords;
+		size_t startOfChecksum = offsetof(JournalHeader, checksum);
+		uint32_t hash = 2166136261u;
+		for(size_t i = 0; i < size; i++){
+				if(i >= startOfChecksum && i < startOfChecksum + sizeof(uint32_t)){
+						continue;
 				}
-				if(*currentFat == FAT_EOC){
-						indexOfUnusedFatBlock = FindUnusedFatLocation();
-						
-						if(indexOfUnusedFatBlock == -1){
-								break;
-						}
-						*currentFat = indexOfUnusedFatBlock;
+				hash = (hash ^ (unsigned char)block[i]) * 16777619u;
+		}
+		return hash;
+}
+
+int AppendJournalRecord(FileSystem *fs, char *blocks, int maxBlocks, int *numOfBlocks, int type, int index, const void *value, size_t sizeOfValue){
+		// records never straddle two blocks
+		// indexes are as wide as a fat entry, so they hold any data block
+		size_t sizeOfRecord = 1 + fs->sizeOfFatEntry + sizeOfValue;
+		JournalHeader *header = NULL;
+		if(*numOfBlocks > 0){
+				header = (JournalHeader*)(blocks + (size_t)(*numOfBlocks - 1) * fs->sizeOfBlock);
+		}
+		if(header == NULL || sizeof(JournalHeader) + header->sizeOfRecords + sizeOfRecord > (size_t)fs->sizeOfBlock){
+				if(*numOfBlocks == maxBlocks){
+						return -1;
 				}
-				FindFatNextLocation(*currentFat, indexOfBlock, indexInBlock);
-				currentFat = &(fs->fatBlocks[*indexOfBlock].fat[*indexInBlock]);
+				header = (JournalHeader*)(blocks + (size_t)*numOfBlocks * fs->sizeOfBlock);
+				memset(header, 0, fs->sizeOfBlock);
+				*numOfBlocks += 1;
+		}
+		char *record = (char*)(header + 1) + header->sizeOfRecords;
+		record[0] = type;
+		WriteFatValue(fs, record + 1, 0, index);
+		memcpy(record + 1 + fs->sizeOfFatEntry, value, sizeOfValue);
+		header->sizeOfRecords += sizeOfRecord;
+		return 0;
+}
 
+int SnapshotJournal(FileSystem *fs, char *blocks, int maxBlocks){
+		// called with the journal locked for writing, so no update is halfway
+		// pack the current value of every entry modified since the last commit
+		// return the number of blocks used, or -1 if they do not fit
+		int numOfBlocks = 0;
+		int isFull = 0;
+		int numOfWords = (fs->numOfDataBlock + 63) / 64;
+		pthread_mutex_lock(&fs->fatLock);
+		for(int i = 0; i < numOfWords && !isFull; i++){
+				for(uint64_t bits = fs->journalFatBitmap[i]; bits != 0 && !isFull; bits &= bits - 1){
+						int location = i * 64 + __builtin_ctzll(bits);
+						// the entry as stored on disk
+						char value[sizeof(uint32_t)];
+						WriteFatValue(fs, value, 0, GetFatEntry(fs, location));
+						isFull = AppendJournalRecord(fs, blocks, maxBlocks, &numOfBlocks, FAT_RECORD, location, value, fs->sizeOfFatEntry);
+				}
 		}
-		
-		fs->RootDirectory[indexOfRootDirectory].sizeOfFile += actualSize;
-		fs->fdWithOffset[fd]  += actualSize;
-		free(bufferStoreLargeBlock);
-		free(partOfBuffer);
-		return actualSize;
+		pthread_mutex_unlock(&fs->fatLock);
+		pthread_rwlock_rdlock(&fs->rootLock);
+		for(int i = 0; i < fs->numOfRootEntries / 64 && !isFull; i++){
+				for(uint64_t bits = fs->journalRootBitmap[i]; bits != 0 && !isFull; bits &= bits - 1){
+						int index = i * 64 + __builtin_ctzll(bits);
+						isFull = AppendJournalRecord(fs, blocks, maxBlocks, &numOfBlocks, ROOT_RECORD, index, &fs->RootDirectory[index], sizeof(RootDirectory));
+				}
+		}
+		pthread_rwlock_unlock(&fs->rootLock);
+		if(isFull){
+				return -1;
+		}
+		// number the blocks after the ones already in the journal
+		for(int i = 0; i < numOfBlocks; i++){
+				JournalHeader *header = (JournalHeader*)(blocks + (size_t)i * fs->sizeOfBlock);
+				header->sequence = fs->superBlock->journalSequence + fs->journalPosition + i;
+				header->isCommit = i == numOfBlocks - 1;
+				header->checksum = JournalChecksum((char*)header);
+		}
+		return numOfBlocks;
+}
 
+void ClearJournalBitmaps(FileSystem *fs){
+		memset(fs->journalFatBitmap, 0, sizeof(uint64_t) * ((fs->numOfDataBlock + 63) / 64));
+		memset(fs->journalRootBitmap, 0, sizeof(uint64_t) * (fs->numOfRootEntries / 64));
 }
 
-int fs_read(int fd, void *buf, size_t count)
-{
-		if(FdCheck(fd) == -1){
+int EmptyJournal(FileSystem *fs){
+		// the metadata written in place must be durable before the journal is emptied
+		// blocks left in the journal are numbered before the new sequence, so they are ignored
+		if(disk_sync(fs->disk)){
 				return -1;
 		}
-		if(count == 0){
+		fs->superBlock->journalSequence += fs->numOfJournalBlock;
+		if(disk_write(fs->disk, 0, fs->superBlock) || disk_sync(fs->disk)){
 				return -1;
 		}
-		if(!buf){
+		fs->journalPosition = 0;
+		return 0;
+}
+
+int ReplayJournalBlock(FileSystem *fs, char *block, uint64_t sequence, char *metadata, int *isModified){
+		// check that the block was fully written as the sequence-th journal block
+		// then, unless isModified is NULL, flag the fat and root directory blocks its
+		// records modify, and unless metadata is NULL, apply the records to them
+		JournalHeader *header = (JournalHeader*)block;
+		if(header->sequence != sequence || header->sizeOfRecords > fs->sizeOfBlock - sizeof(JournalHeader)
+				|| header->checksum != JournalChecksum(block)){
 				return -1;
 		}
-		char filename[FS_FILENAME_LEN];
-		strcpy(filename, fs->fdWithFileName[fd]);
-		uint64_t offsetOfFile = fs->fdWithOffset[fd];
-		const char *constFilename = filename;
-		int indexOfRootDirectory = FindFileLocation(constFilename);
-		if(fs->fdWithOffset[fd] > (uint64_t)fs->RootDirectory[indexOfRootDirectory].sizeOfFile){
-				return -1;
-		}
-		int numOfReadTimes = (count + (int)offsetOfFile) / BLOCK_SIZE;
-		size_t checkSize = numOfReadTimes * BLOCK_SIZE;
-		if((count + (int)offsetOfFile) > checkSize){
-				numOfReadTimes += 1;
-				checkSize = (count + (int)offsetOfFile - checkSize) + numOfReadTimes * BLOCK_SIZE;
-		}
-		int* indexOfBlock = (int*)malloc(sizeof(int));
-		int* indexInBlock = (int*)malloc(sizeof(int));
-		int remainSize = count;
-		int actualSize = 0;
-		void* partOfBuffer = malloc(BLOCK_SIZE);
-		void* bufferStoreLargeBlock = malloc(BLOCK_SIZE * numOfReadTimes);
-		int indexOfFat = fs->RootDirectory[indexOfRootDirectory].indexOfFirstBlock;
-		int startOffsetInBlock = 0;
-	
-		if(offsetOfFile != 0){
-				int fatOffsetPoint = offsetOfFile / BLOCK_SIZE;
-				indexOfFat = indexOfFat + fatOffsetPoint;
-				startOffsetInBlock = offsetOfFile - (fatOffsetPoint * BLOCK_SIZE);
-		}
-
-		FindFatNextLocation(indexOfFat, indexOfBlock, indexInBlock);
-		for(int i = 0; i < numOfReadTimes; i++){
-				block_read(fs->superBlock->indexOfStartBlock + indexOfFat , partOfBuffer);
-				FindFatNextLocation(indexOfFat, indexOfBlock, indexInBlock);
-				indexOfFat = fs->fatBlocks[*indexOfBlock].fat[*indexInBlock];
-				if(remainSize > BLOCK_SIZE){
-						memcpy(bufferStoreLargeBlock +  BLOCK_SIZE * i, partOfBuffer, BLOCK_SIZE);
-						actualSize += BLOCK_SIZE;
-						remainSize -= BLOCK_SIZE;
+		int numOfFatBlock = fs->numOfFatBlock;
+		char *record = (char*)(header + 1);
+		char *endOfRecords = record + header->sizeOfRecords;
+		size_t sizeOfFatEntry = fs->sizeOfFatEntry;
+		while(record < endOfRecords){
+				char *value = record + 1 + sizeOfFatEntry;
+				if(value > endOfRecords){
+						return -1;
+				}
+				uint32_t index;
+				if(sizeOfFatEntry == sizeof(uint32_t)){
+						memcpy(&index, record + 1, sizeof(uint32_t));
 				}else{
-						memcpy(bufferStoreLargeBlock + BLOCK_SIZE * i, partOfBuffer, BLOCK_SIZE);
-						actualSize += remainSize;
-						remainSize -= remainSize;
+						uint16_t shortIndex;
+						memcpy(&shortIndex, record + 1, sizeof(uint16_t));
+						index = shortIndex;
 				}
-				if(indexOfFat == -1){
-						break;
+				if(record[0] == FAT_RECORD && index < (uint32_t)fs->numOfDataBlock
+						&& value + sizeOfFatEntry <= endOfRecords){
+						if(isModified != NULL){
+								isModified[index / fs->numOfFatEntries] = 1;
+						}
+						if(metadata != NULL){
+								memcpy(metadata + (size_t)index * sizeOfFatEntry, value, sizeOfFatEntry);
+						}
+						record = value + sizeOfFatEntry;
+				}else if(record[0] == ROOT_RECORD && index < (uint32_t)fs->numOfRootEntries
+						&& value + sizeof(RootDirectory) <= endOfRecords){
+						if(isModified != NULL){
+								isModified[numOfFatBlock + index / (fs->sizeOfBlock / sizeof(RootDirectory))] = 1;
+						}
+						if(metadata != NULL){
+								memcpy(metadata + (size_t)numOfFatBlock * fs->sizeOfBlock + index * sizeof(RootDirectory), value, sizeof(RootDirectory));
+						}
+						record = value + sizeof(RootDirectory);
+				}else{
+						return -1;
 				}
-				
 		}
-		uint64_t endOffset = offsetOfFile + actualSize;
-		
-		memcpy(buf, bufferStoreLargeBlock + startOffsetInBlock, actualSize);
-		free(bufferStoreLargeBlock);
-		free(partOfBuffer);
+		return 0;
+}
 
-		fs->fdWithOffset[fd] = endOffset;
+int ReplayJournal(FileSystem *fs){
+		// redo the transactions committed since the last checkpoint on the fat and
+		// root directory blocks, then empty the journal
+		// only the metadata blocks that the records modify are read and written
+		int numOfJournalBlock = fs->numOfJournalBlock;
+		int numOfFatBlock = fs->numOfFatBlock;
+		int numOfMetadataBlock = numOfFatBlock + fs->numOfRootBlock;
+		char *journal = (char*)malloc((size_t)numOfJournalBlock * fs->sizeOfBlock);
+		// the fat blocks, followed by the root directory blocks
+		char *metadata = (char*)malloc((size_t)numOfMetadataBlock * fs->sizeOfBlock);
+		int *isModified = (int*)calloc(numOfMetadataBlock, sizeof(int));
+		struct disk_request *requests = (struct disk_request*)malloc(sizeof(struct disk_request) * numOfMetadataBlock);
+		int ret = -1;
+		if(journal != NULL && metadata != NULL && isModified != NULL && requests != NULL){
+				struct disk_request read = {fs->indexOfStartBlock + fs->indexOfJournalBlock, numOfJournalBlock, journal, 0};
+				ret = disk_submit(fs->disk, &read, 1);
+		}
+		if(ret == 0){
+				// stop at the first block that is not part of the journal, and
+				// ignore the blocks of the last transaction if it was not committed
+				int numOfCommittedBlock = 0;
+				for(int i = 0; i < numOfJournalBlock; i++){
+						char *block = journal + (size_t)i * fs->sizeOfBlock;
+						if(ReplayJournalBlock(fs, block, fs->superBlock->journalSequence + i, NULL, NULL)){
+								break;
+						}
+						if(((JournalHeader*)block)->isCommit){
+								numOfCommittedBlock = i + 1;
+						}
+				}
+				for(int i = 0; i < numOfCommittedBlock; i++){
+						ReplayJournalBlock(fs, journal + (size_t)i * fs->sizeOfBlock, fs->superBlock->journalSequence + i, NULL, isModified);
+				}
+				int numOfRequests = 0;
+				for(int i = 0; i < numOfMetadataBlock; i++){
+						if(isModified[i]){
+								requests[numOfRequests].block = i < numOfFatBlock ? (size_t)i + 1 : (size_t)fs->indexOfRootDirectory + i - numOfFatBlock;
+								requests[numOfRequests].count = 1;
+								requests[numOfRequests].buf = metadata + (size_t)i * fs->sizeOfBlock;
+								requests[numOfRequests].is_write = 0;
+								numOfRequests += 1;
+						}
+				}
+				if(disk_submit(fs->disk, requests, numOfRequests)){
+						ret = -1;
+				}else{
+						for(int i = 0; i < numOfCommittedBlock; i++){
+								ReplayJournalBlock(fs, journal + (size_t)i * fs->sizeOfBlock, fs->superBlock->journalSequence + i, metadata, NULL);
+						}
+						for(int i = 0; i < numOfRequests; i++){
+								requests[i].is_write = 1;
+						}
+						if(disk_submit(fs->disk, requests, numOfRequests) || EmptyJournal(fs)){
+								ret = -1;
+						}
+				}
+		}
+		free(journal);
+		free(metadata);
+		free(isModified);
+		free(requests);
+		return ret;
+}
+
+void RequeueJournalRecords(FileSystem *fs, char *blocks, int numOfBlocks){
+		// called with the journal locked for writing
+		// the entries of a commit that could not be written go in the next one
+		size_t sizeOfFatEntry = fs->sizeOfFatEntry;
+		for(int i = 0; i < numOfBlocks; i++){
+				JournalHeader *header = (JournalHeader*)(blocks + (size_t)i * fs->sizeOfBlock);
+				char *record = (char*)(header + 1);
+				char *endOfRecords = record + header->sizeOfRecords;
+				while(record < endOfRecords){
+						uint32_t index = 0;
+						memcpy(&index, record + 1, sizeOfFatEntry);
+						if(record[0] == FAT_RECORD){
+								fs->journalFatBitmap[index / 64] |= (uint64_t)1 << (index % 64);
+								record += 1 + sizeOfFatEntry + sizeOfFatEntry;
+						}else{
+								fs->journalRootBitmap[index / 64] |= (uint64_t)1 << (index % 64);
+								record += 1 + sizeOfFatEntry + sizeof(RootDirectory);
+						}
+				}
+		}
+}
+
+int WriteMetadataInPlace(FileSystem *fs){
+		// called with the journal locked for writing, and empty
+		// for updates too many for the whole journal, which are then not atomic
+		if(cache_flush(fs->cache) || SyncMetadata(fs) || disk_sync(fs->disk)){
+				return -1;
+		}
+		ClearJournalBitmaps(fs);
+		return 0;
+}
+
+int CommitJournal(FileSystem *fs){
+		// group commit: the updates made while a commit is written all go in the next one
+		if(!fs->isJournaled){
+				return 0;
+		}
+		STATS_OP(FS_OP_COMMIT);
+		pthread_mutex_lock(&fs->commitLock);
+		pthread_rwlock_wrlock(&fs->journalLock);
+		int numOfBlocks = SnapshotJournal(fs, fs->journalBuffer, fs->numOfJournalBlock - fs->journalPosition);
+		if(numOfBlocks == -1 && fs->journalPosition > 0){
+				// the journal is full: checkpoint it by writing the committed
+				// records in place, as fs_mount would replay them, which empties
+				// it, then commit the pending updates to it
+				// the metadata in memory is never written in place, as it holds
+				// updates not committed yet
+				// other threads can keep updating the metadata meanwhile
+				pthread_rwlock_unlock(&fs->journalLock);
+				int ret = ReplayJournal(fs);
+				pthread_rwlock_wrlock(&fs->journalLock);
+				if(ret){
+						pthread_rwlock_unlock(&fs->journalLock);
+						pthread_mutex_unlock(&fs->commitLock);
+						return -1;
+				}
+				numOfBlocks = SnapshotJournal(fs, fs->journalBuffer, fs->numOfJournalBlock);
+		}
+		if(numOfBlocks == -1){
+				int ret = WriteMetadataInPlace(fs);
+				pthread_rwlock_unlock(&fs->journalLock);
+				pthread_mutex_unlock(&fs->commitLock);
+				return ret;
+		}
+		// writes set the flag once done, so the ones that end later are left to the next commit
+		int isDataWritten = __atomic_exchange_n(&fs->isDataWritten, 0, __ATOMIC_ACQ_REL);
+		if(numOfBlocks == 0 && !isDataWritten){
+				// nothing to make durable, as after a read-only open and close
+				pthread_rwlock_unlock(&fs->journalLock);
+				pthread_mutex_unlock(&fs->commitLock);
+				return 0;
+		}
+		ClearJournalBitmaps(fs);
+		pthread_rwlock_unlock(&fs->journalLock);
+		// data first, durable before the journal so the metadata never
+		// points at blocks not yet written, and even without any metadata
+		// update, as overwritten blocks must be durable as well
+		// then the whole transaction with a single sequential write
+		struct disk_request request = {
+				.block = fs->indexOfStartBlock + fs->indexOfJournalBlock + fs->journalPosition,
+				.count = numOfBlocks,
+				.buf = fs->journalBuffer,
+				.is_write = 1,
+		};
+		int ret = 0;
+		if(cache_flush(fs->cache) || disk_sync(fs->disk)
+				|| (numOfBlocks > 0 && (disk_submit(fs->disk, &request, 1) || disk_sync(fs->disk)))){
+				// the next commit writes the same blocks again
+				pthread_rwlock_wrlock(&fs->journalLock);
+				RequeueJournalRecords(fs, fs->journalBuffer, numOfBlocks);
+				pthread_rwlock_unlock(&fs->journalLock);
+				__atomic_store_n(&fs->isDataWritten, 1, __ATOMIC_RELEASE);
+				ret = -1;
+		}else{
+				fs->journalPosition += numOfBlocks;
+		}
+		pthread_mutex_unlock(&fs->commitLock);
+		return ret;
+}
+
+int StartJournal(FileSystem *fs){
+		// track the updates to commit, on disks that have a journal
+		int numOfWords = (fs->numOfDataBlock + 63) / 64;
+		fs->journalFatBitmap = (uint64_t*)calloc(numOfWords, sizeof(uint64_t));
+		fs->journalBuffer = (char*)malloc((size_t)fs->numOfJournalBlock * fs->sizeOfBlock);
+		if(fs->journalFatBitmap == NULL || fs->journalBuffer == NULL){
+				return -1;
+		}
+		fs->isJournaled = 1;
+		return 0;
+}
+
+int OpenJournal(FileSystem *fs){
+		// called by fs_mount before the fat and root directory are read
+		if(fs->superBlock->journalSignature != JOURNAL_SIGNATURE){
+				return 0;
+		}
+		if(fs->numOfJournalBlock <= 0 || fs->indexOfJournalBlock <= 0
+				|| (int64_t)fs->indexOfJournalBlock + fs->numOfJournalBlock > fs->numOfDataBlock){
+				return -1;
+		}
+		return ReplayJournal(fs);
+}
+
+int CreateJournal(FileSystem *fs, size_t numOfBlocks){
+		// the journal is a run of contiguous data blocks, chained in the fat like
+		// a file without a root directory entry, so other tools leave it alone
+		if(numOfBlocks > UINT16_MAX || (int)numOfBlocks >= fs->numOfDataBlock){
+				return -1;
+		}
+		int lengthOfRun = 0;
+		pthread_mutex_lock(&fs->fatLock);
+		// every run must be known to find one long enough
+		int start = -1;
+		if(LoadAllFatBlocks(fs) == 0){
+				start = FindFreeRun(fs, numOfBlocks, &lengthOfRun);
+		}
+		if(start == -1 || lengthOfRun < (int)numOfBlocks){
+				pthread_mutex_unlock(&fs->fatLock);
+				return -1;
+		}
+		for(int i = 0; i < (int)numOfBlocks; i++){
+				SetFatEntry(fs, start + i, i + 1 < (int)numOfBlocks ? (uint32_t)(start + i + 1) : FAT_EOC);
+		}
+		pthread_mutex_unlock(&fs->fatLock);
+		fs->superBlock->journalSignature = JOURNAL_SIGNATURE;
+		fs->indexOfJournalBlock = start;
+		fs->numOfJournalBlock = numOfBlocks;
+		if(fs->superBlock->formatVersion == FS_FORMAT_EXTENDED){
+				fs->superBlock->indexOfJournalBlockExt = start;
+				fs->superBlock->numOfJournalBlockExt = numOfBlocks;
+		}else{
+				fs->superBlock->indexOfJournalBlock = start;
+				fs->superBlock->numOfJournalBlock = numOfBlocks;
+		}
+		fs->superBlock->journalSequence = 1;
+		// the fat first, so that the journal blocks are never seen as free
+		if(SyncMetadata(fs) || disk_sync(fs->disk) || disk_write(fs->disk, 0, fs->superBlock) || disk_sync(fs->disk)){
+				return -1;
+		}
+		return 0;
+}
+
+int LoadGeometry(FileSystem *fs){
+		// the original format uses 16-bit fields, the extended one 32-bit fields
+		// in the unused bytes, and disks of blocks bigger than BLOCK_SIZE
+		SuperBlock *superBlock = fs->superBlock;
+		if(superBlock->formatVersion == FS_FORMAT_EXTENDED){
+				uint32_t sizeOfBlock = superBlock->sizeOfBlock;
+				if(sizeOfBlock < BLOCK_SIZE || sizeOfBlock > BLOCK_SIZE_MAX
+						|| disk_set_block_size(fs->disk, sizeOfBlock)){
+						return -1;
+				}
+				// every data block needs an index below FAT_EOC and a place in the fat
+				uint32_t numOfRootBlock = superBlock->numOfRootBlockExt ? superBlock->numOfRootBlockExt : 1;
+				if(superBlock->numOfDataBlockExt >= INT32_MAX
+						|| superBlock->numOfFatBlockExt > superBlock->numOfDataBlockExt
+						|| numOfRootBlock > INT32_MAX / (sizeOfBlock / sizeof(RootDirectory))
+						|| superBlock->indexOfRootDirectoryExt != superBlock->numOfFatBlockExt + 1
+						|| superBlock->indexOfStartBlockExt != (uint64_t)superBlock->numOfFatBlockExt + numOfRootBlock + 1){
+						return -1;
+				}
+				fs->numOfRootBlock = numOfRootBlock;
+				fs->sizeOfBlock = sizeOfBlock;
+				fs->sizeOfFatEntry = sizeof(uint32_t);
+				fs->numOfBlocks = superBlock->numOfBlocksExt;
+				fs->indexOfRootDirectory = superBlock->indexOfRootDirectoryExt;
+				fs->indexOfStartBlock = superBlock->indexOfStartBlockExt;
+				fs->numOfDataBlock = superBlock->numOfDataBlockExt;
+				fs->numOfFatBlock = superBlock->numOfFatBlockExt;
+				fs->indexOfJournalBlock = superBlock->indexOfJournalBlockExt;
+				fs->numOfJournalBlock = superBlock->numOfJournalBlockExt;
+		}else if(superBlock->formatVersion == 0){
+				fs->sizeOfBlock = BLOCK_SIZE;
+				fs->sizeOfFatEntry = sizeof(uint16_t);
+				fs->numOfRootBlock = 1;
+				fs->numOfBlocks = superBlock->numOfBlocks;
+				fs->indexOfRootDirectory = superBlock->indexOfRootDirectory;
+				fs->indexOfStartBlock = superBlock->indexOfStartBlock;
+				fs->numOfDataBlock = superBlock->numOfDataBlock;
+				fs->numOfFatBlock = superBlock->numOfFatBlock;
+				fs->indexOfJournalBlock = superBlock->indexOfJournalBlock;
+				fs->numOfJournalBlock = superBlock->numOfJournalBlock;
+		}else{
+				return -1;
+		}
+		fs->numOfFatEntries = fs->sizeOfBlock / fs->sizeOfFatEntry;
+		fs->numOfRootEntries = fs->numOfRootBlock * (fs->sizeOfBlock / sizeof(RootDirectory));
+		if((int64_t)fs->numOfFatBlock * fs->numOfFatEntries < fs->numOfDataBlock){
+				return -1;
+		}
+		// keep the whole superblock, to write it back as it was
+		if(fs->sizeOfBlock > BLOCK_SIZE){
+				superBlock = (SuperBlock*)realloc(superBlock, fs->sizeOfBlock);
+				if(superBlock == NULL){
+						return -1;
+				}
+				fs->superBlock = superBlock;
+				if(disk_read(fs->disk, 0, superBlock)){
+						return -1;
+				}
+		}
+		return 0;
+}
+
+int AllocateBlockBuffers(FileSystem *fs){
+		// one scratch block per fd, and a block of zeros, sized for the disk
+		fs->scratchBlocks = (char*)malloc((size_t)FS_OPEN_MAX_COUNT * fs->sizeOfBlock);
+		fs->zeroBlock = (char*)calloc(1, fs->sizeOfBlock);
+		if(fs->scratchBlocks == NULL || fs->zeroBlock == NULL){
+				return -1;
+		}
+		for(int i = 0; i < FS_OPEN_MAX_COUNT; i++){
+				fs->openFiles[i].scratchBlock = fs->scratchBlocks + (size_t)i * fs->sizeOfBlock;
+		}
+		return 0;
+}
+
+fs_t *fs_mount_h(const char *diskname)
+{
+	STATS_OP(FS_OP_MOUNT);
+	FileSystem *fs = (FileSystem*)calloc(1, sizeof(FileSystem));
+	if(fs == NULL){
+			return NULL;
+	}
+	InitLocks(fs);
+	// check if the disk can be open or not
+	fs->diskBackend = diskBackendOfNextMount;
+	int blockBackend = BLOCK_BACKEND_FILE;
+	if(fs->diskBackend == FS_DISK_MMAP){
+			blockBackend = BLOCK_BACKEND_MMAP;
+	}
+	fs->disk = disk_open(diskname, blockBackend);
+	if(fs->disk == NULL){
+			return MountFailed(fs);
+	}
+	fs->superBlock = (SuperBlock*)malloc(sizeof(SuperBlock));
+	// read the superblock from disk
+	if(fs->superBlock == NULL || disk_read(fs->disk, 0, fs->superBlock)){
+			return MountFailed(fs);
+	}
+	// check the signature of the file system correspond 
+	// to the one defined by the specifications
+	if (fs->superBlock->Signature != SIGNATURE){
+			return MountFailed(fs);
+	}
+	// sets the block size of the disk, so only trace the accesses after
+	if(LoadGeometry(fs) || AllocateBlockBuffers(fs)){
+			return MountFailed(fs);
+	}
+	if(traceFileOfNextMount != NULL && disk_trace(fs->disk, traceFileOfNextMount)){
+			return MountFailed(fs);
+	}
+	// get the number of block and check if the number is correct
+	int numOfBlocks = disk_count(fs->disk);
+	if(numOfBlocks == -1){
+			return MountFailed(fs);
+	}
+	int numOfFatBlock = fs->numOfFatBlock;
+	// check if number of block is correct
+	// total # of block = # of fat + # of data + superblock + rootdirectory
+	if((int64_t)numOfBlocks != (int64_t)fs->numOfFatBlock + fs->numOfDataBlock + fs->numOfRootBlock + 1){
+			return MountFailed(fs);
+	}
+	// redo the metadata updates committed to the journal before a crash
+	int isJournaled = fs->superBlock->journalSignature == JOURNAL_SIGNATURE;
+	if(OpenJournal(fs)){
+			return MountFailed(fs);
+	}
+	// fat blocks are read now, or on first use in lazy mode
+	fs->fatBlocks = (FATBlock*)calloc(numOfFatBlock, sizeof(FATBlock));
+	fs->fatLoading = fatLoadingOfNextMount;
+	// index the free data blocks of every fat block
+	if(fs->fatBlocks == NULL || BuildFreeBlockBitmap(fs)){
+			return MountFailed(fs);
+	}
+	// read the first root directory block, the others are read when a lookup needs them
+	// their filenames are indexed and their unused entries counted as they are read
+	if(AllocateRootDirectory(fs) || LoadRootBlock(fs, 0)){
+			return MountFailed(fs);
+	}
+	// reserve a journal if asked to and the disk does not have one yet
+	if(!isJournaled && journalSizeOfNextMount > 0){
+			if(CreateJournal(fs, journalSizeOfNextMount)){
+					return MountFailed(fs);
+			}
+			isJournaled = 1;
+	}
+	if(isJournaled && StartJournal(fs)){
+			return MountFailed(fs);
+	}
+	// no need to cache blocks that are already mapped in memory
+	size_t cacheSize = cacheSizeOfNextMount;
+	if(fs->diskBackend == FS_DISK_MMAP){
+			cacheSize = 0;
+	}
+	fs->cache = cache_create(fs->disk, cacheSize);
+	if(fs->cache == NULL){
+			return MountFailed(fs);
+	}
+	// keep room in the cache for the blocks that are not read sequentially
+	fs->maxReadahead = cacheSize / 2;
+	if(fs->maxReadahead > FS_READAHEAD_MAX_BLOCKS){
+			fs->maxReadahead = FS_READAHEAD_MAX_BLOCKS;
+	}
+	fs->async = async_create(FS_ASYNC_THREADS);
+	if(fs->async == NULL){
+			cache_destroy(fs->cache);
+			return MountFailed(fs);
+	}
+	fs->isMounted = MOUNTED;
+	// every fd is unused
+	fs->freeFdBitmap = ~(uint64_t)0 >> (64 - FS_OPEN_MAX_COUNT);
+	return fs;
+}
+
+int PrepareUnmount(FileSystem *fs){
+		// everything that can fail, so that a failed unmount leaves the file
+		// system mounted, and a later one can try again
+		if(fs == NULL || fs->isMounted == UNMOUNTED){
+				return -1;
+		}
+		async_drain(fs->async);
+		if(fs->numOfOpenFiles != 0){
+				return -1;
+		}
+		// write back dirty data blocks, then commit the modified metadata
+		// so that the journal holds whatever is written in place, which
+		// then leaves nothing to replay in the journal
+		if(cache_flush(fs->cache) || CommitJournal(fs) || SyncMetadata(fs) || (fs->isJournaled && EmptyJournal(fs))){
+				return -1;
+		}
+		return 0;
+}
+
+int ReleaseFileSystem(FileSystem *fs){
+		// nothing is dirty anymore, the file system is released even if the
+		// disk reports an error when it is closed
+		fs->isMounted = UNMOUNTED;
+		int ret = cache_destroy(fs->cache);
+		if(disk_close(fs->disk)){
+				ret = -1;
+		}
+		// free data structure: filesystem, fatblock, RootDirectory, superBlock
+		FreeFileSystem(fs);
+		return ret;
+}
+
+int fs_umount_h(fs_t *fs)
+{
+		STATS_OP(FS_OP_UMOUNT);
+		if(PrepareUnmount(fs)){
+				return -1;
+		}
+		return ReleaseFileSystem(fs);
+}
+
+int fs_set_cache_size(size_t nblocks)
+{
+		// only takes effect on the next mount
+		if(defaultFs != NULL){
+				return -1;
+		}
+		cacheSizeOfNextMount = nblocks;
+		return 0;
+}
+
+int fs_set_disk_backend(int backend)
+{
+		// only takes effect on the next mount
+		if(defaultFs != NULL){
+				return -1;
+		}
+		if(backend != FS_DISK_FILE && backend != FS_DISK_MMAP){
+				return -1;
+		}
+		diskBackendOfNextMount = backend;
+		return 0;
+}
+
+int fs_set_fat_loading(int mode)
+{
+		// only takes effect on the next mount
+		if(defaultFs != NULL){
+				return -1;
+		}
+		if(mode != FS_FAT_EAGER && mode != FS_FAT_LAZY){
+				return -1;
+		}
+		fatLoadingOfNextMount = mode;
+		return 0;
+}
+
+int fs_set_journal_size(size_t nblocks)
+{
+		// only takes effect on the next mount
+		if(defaultFs != NULL){
+				return -1;
+		}
+		if(nblocks > UINT16_MAX){
+				return -1;
+		}
+		journalSizeOfNextMount = nblocks;
+		return 0;
+}
+
+int fs_set_trace(const char *filename)
+{
+		// only takes effect on the next mount
+		if(defaultFs != NULL){
+				return -1;
+		}
+		char *copy = NULL;
+		if(filename != NULL){
+				copy = strdup(filename);
+				if(copy == NULL){
+						return -1;
+				}
+		}
+		free(traceFileOfNextMount);
+		traceFileOfNextMount = copy;
+		return 0;
+}
+
+int fs_format(const char *diskname, size_t data_blk_count, size_t block_size, size_t file_count)
+{
+		// a power of two, so that disk offsets never straddle two blocks
+		if(diskname == NULL || block_size < BLOCK_SIZE || block_size > BLOCK_SIZE_MAX
+				|| (block_size & (block_size - 1)) != 0){
+				return -1;
+		}
+		size_t numOfFatEntries = block_size / sizeof(uint32_t);
+		size_t numOfFatBlock = (data_blk_count + numOfFatEntries - 1) / numOfFatEntries;
+		size_t numOfRootEntries = block_size / sizeof(RootDirectory);
+		size_t numOfRootBlock = (file_count + numOfRootEntries - 1) / numOfRootEntries;
+		if(data_blk_count == 0 || file_count == 0 || data_blk_count >= INT32_MAX
+				|| file_count >= INT32_MAX || data_blk_count + numOfFatBlock + numOfRootBlock + 1 >= INT32_MAX){
+				return -1;
+		}
+		size_t numOfBlocks = numOfFatBlock + numOfRootBlock + data_blk_count + 1;
+		// a new file is all zeros: unused fat entries, empty root directory blocks
+		FILE *file = fopen(diskname, "w");
+		if(file == NULL){
+				return -1;
+		}
+		if(fclose(file) || truncate(diskname, (off_t)numOfBlocks * block_size)){
+				return -1;
+		}
+		disk_t *disk = disk_open(diskname, BLOCK_BACKEND_FILE);
+		if(disk == NULL){
+				return -1;
+		}
+		char *block = (char*)calloc(1, block_size);
+		int ret = -1;
+		if(block != NULL && disk_set_block_size(disk, block_size) == 0){
+				// entry 0 is reserved, it ends an empty chain
+				((uint32_t*)block)[0] = FAT_EOC;
+				ret = disk_write(disk, 1, block);
+				memset(block, 0, block_size);
+				// the 16-bit counts stay zero, so tools that only know the
+				// original format reject the disk
+				SuperBlock *superBlock = (SuperBlock*)block;
+				superBlock->Signature = SIGNATURE;
+				superBlock->formatVersion = FS_FORMAT_EXTENDED;
+				superBlock->sizeOfBlock = block_size;
+				superBlock->numOfBlocksExt = numOfBlocks;
+				superBlock->indexOfRootDirectoryExt = numOfFatBlock + 1;
+				superBlock->indexOfStartBlockExt = numOfFatBlock + numOfRootBlock + 1;
+				superBlock->numOfDataBlockExt = data_blk_count;
+				superBlock->numOfFatBlockExt = numOfFatBlock;
+				superBlock->numOfRootBlockExt = numOfRootBlock;
+				if(ret == 0 && (disk_write(disk, 0, block) || disk_sync(disk))){
+						ret = -1;
+				}
+		}
+		free(block);
+		if(disk_close(disk)){
+				ret = -1;
+		}
+		return ret;
+}
+
+int fs_stats(struct fs_stats *stats)
+{
+		// kept for the whole process rather than per file system
+		if(stats == NULL){
+				return -1;
+		}
+		return stats_get(stats);
+}
+
+int fs_stats_reset(void)
+{
+		return stats_reset();
+}
+
+const char *fs_stats_name(int op)
+{
+		return stats_name(op);
+}
+
+int fs_flush_h(fs_t *fs)
+{
+		STATS_OP(FS_OP_FLUSH);
+		if(fs == NULL || fs->isMounted == UNMOUNTED){
+				return -1;
+		}
+		return cache_flush(fs->cache);
+}
+
+int fs_sync_h(fs_t *fs)
+{
+		STATS_OP(FS_OP_SYNC);
+		if(fs == NULL || fs->isMounted == UNMOUNTED){
+				return -1;
+		}
+		// commit the metadata updates to the journal if there is one
+		if(fs->isJournaled){
+				return CommitJournal(fs);
+		}
+		// data first, so metadata never points at blocks not yet written
+		if(cache_flush(fs->cache)){
+				return -1;
+		}
+		return SyncMetadata(fs);
+}
+
+int fs_cache_stats_h(fs_t *fs, struct fs_cache_stats *stats)
+{
+		if(fs == NULL || fs->isMounted == UNMOUNTED || stats == NULL){
+				return -1;
+		}
+		struct cache_stats cacheStats;
+		cache_get_stats(fs->cache, &cacheStats);
+		stats->hits = cacheStats.hits;
+		stats->misses = cacheStats.misses;
+		stats->evictions = cacheStats.evictions;
+		stats->writebacks = cacheStats.writebacks;
+		stats->prefetches = cacheStats.prefetches;
+		return 0;
+}
+
+int fs_statfs_h(fs_t *fs, struct fs_statfs *stats)
+{
+		STATS_OP(FS_OP_STATFS);
+		if(fs == NULL || fs->isMounted == UNMOUNTED || stats == NULL){
+				return -1;
+		}
+		// free blocks are only all counted once every fat block is loaded
+		pthread_mutex_lock(&fs->fatLock);
+		int ret = LoadAllFatBlocks(fs);
+		// every count is maintained by the mount, allocation and free paths
+		stats->data_blk_free = fs->numOfUnusedDataBlock;
+		pthread_mutex_unlock(&fs->fatLock);
+		if(ret){
+				return -1;
+		}
+		stats->total_blk_count = fs->numOfBlocks;
+		stats->fat_blk_count = fs->numOfFatBlock;
+		stats->rdir_blk = fs->indexOfRootDirectory;
+		stats->data_blk = fs->indexOfStartBlock;
+		stats->data_blk_count = fs->numOfDataBlock;
+		stats->blk_size = fs->sizeOfBlock;
+		stats->rdir_count = fs->numOfRootEntries;
+		// likewise for the unused entries of the root directory blocks
+		pthread_rwlock_rdlock(&fs->rootLock);
+		ret = LoadAllRootBlocks(fs);
+		stats->rdir_free = fs->numOfUnusedRootDirectory;
+		pthread_rwlock_unlock(&fs->rootLock);
+		return ret ? -1 : 0;
+}
+
+int fs_info_h(fs_t *fs)
+{
+		struct fs_statfs stats;
+		if(fs_statfs_h(fs, &stats) == -1){
+				return -1;
+		}
+		// print the file system information based on reference
+		printf("FS Info:\n");
+		printf("total_blk_count=%zu\n", stats.total_blk_count);
+		printf("fat_blk_count=%zu\n", stats.fat_blk_count);
+		printf("rdir_blk=%zu\n", stats.rdir_blk);
+		printf("data_blk=%zu\n", stats.data_blk);
+		printf("data_blk_count=%zu\n", stats.data_blk_count);
+		printf("fat_free_ratio=%zu/%zu\n", stats.data_blk_free, stats.data_blk_count);
+		printf("rdir_free_ratio=%zu/%zu\n", stats.rdir_free, stats.rdir_count);
+		return 0;
+}
+
+int FileCheck(FileSystem *fs, const char *filename){
+	// check if the file is mounte or not
+	// check if filename is correct(NULL, more than 16 chars, no file name)
+		if(fs == NULL || fs->isMounted == UNMOUNTED){
+				return -1;
+		}
+		if(filename == NULL){
+				return -1;
+		}
+		if(strlen(filename) >= FS_FILENAME_LEN || strlen(filename) == 0){
+				return -1;
+		}
+		return 0;
+}
+
+int FindFileLocation(FileSystem *fs, const char *filename){
+		STATS_OP(FS_OP_LOOKUP);
+		// called with the root directory locked for reading or writing
+		// a file is in its home block, or in one of the following blocks if the
+		// ones before it overflowed, so only these blocks need to be read
+		// return -1 if there is no such file, -2 if a block cannot be read
+		unsigned int hash = HashFilename(filename);
+		int numOfEntries = fs->sizeOfBlock / sizeof(RootDirectory);
+		int indexOfBlock = hash % fs->numOfRootBlock;
+		for(int i = 0; i < fs->numOfRootBlock; i++){
+				if(LoadRootBlock(fs, indexOfBlock)){
+						return -2;
+				}
+				if(!(fs->RootDirectory[indexOfBlock * numOfEntries].rootBlockFlags & ROOT_BLOCK_OVERFLOWED)){
+						break;
+				}
+				indexOfBlock = (indexOfBlock + 1) % fs->numOfRootBlock;
+		}
+		// based on filename find the index of entry in the hash index
+		for(int i = __atomic_load_n(&fs->rootHashBuckets[hash % fs->numOfRootHashBuckets], __ATOMIC_ACQUIRE); i != -1; i = fs->rootHashNext[i]){
+				if(strncmp(filename, fs->RootDirectory[i].filename, FS_FILENAME_LEN) == 0){
+						return i;
+				}
+		}
+		return -1;
+}
+
+int FindUnusedRootLocation(FileSystem *fs, const char *filename){
+	// return the first unused root location for file, in its home block
+	// or in the first following block that is not full
+	int numOfEntries = fs->sizeOfBlock / sizeof(RootDirectory);
+	int indexOfBlock = HashFilename(filename) % fs->numOfRootBlock;
+	for(int i = 0; i < fs->numOfRootBlock; i++){
+				if(LoadRootBlock(fs, indexOfBlock)){
+						return -1;
+				}
+				int firstEntry = indexOfBlock * numOfEntries;
+				for(int j = firstEntry / 64; j < (firstEntry + numOfEntries) / 64; j++){
+						if(fs->freeRootBitmap[j] != 0){
+								return j * 64 + __builtin_ctzll(fs->freeRootBitmap[j]);
+						}
+				}
+				// lookups of the files put further must go on past this block
+				int nextBlock = (indexOfBlock + 1) % fs->numOfRootBlock;
+				if(nextBlock != indexOfBlock && !(fs->RootDirectory[firstEntry].rootBlockFlags & ROOT_BLOCK_OVERFLOWED)){
+						fs->RootDirectory[firstEntry].rootBlockFlags |= ROOT_BLOCK_OVERFLOWED;
+						MarkRootEntryDirty(fs, firstEntry);
+				}
+				indexOfBlock = nextBlock;
+		}
+	return -1;
+}
+
+int fs_create_h(fs_t *fs, const char *filename)
+{
+		STATS_OP(FS_OP_CREATE);
+		// check if FS is not mount, filename invalid
+		if(FileCheck(fs, (char*)filename) == -1){
+				return -1;
+		}
+		BeginMetadataUpdate(fs);
+		pthread_rwlock_wrlock(&fs->rootLock);
+		// check if the filename has been used
+		// get the root index of this new file
+		// -1 if all root location are used(root directory is full)
+		int startIndexOfRootDirectory = -1;
+		if(FindFileLocation(fs, filename) == -1){
+				startIndexOfRootDirectory = FindUnusedRootLocation(fs, filename);
+		}
+		if(startIndexOfRootDirectory == -1){
+				pthread_rwlock_unlock(&fs->rootLock);
+				EndMetadataUpdate(fs);
+				return -1;
+		}
+		// initialization of new file
+		strcpy(fs->RootDirectory[startIndexOfRootDirectory].filename, filename);
+		fs->RootDirectory[startIndexOfRootDirectory].sizeOfFile = 0;
+		SetFirstBlock(fs, &fs->RootDirectory[startIndexOfRootDirectory], FAT_EOC);
+		AddFileToIndex(fs, startIndexOfRootDirectory);
+		MarkRootEntryDirty(fs, startIndexOfRootDirectory);
+		pthread_rwlock_unlock(&fs->rootLock);
+		EndMetadataUpdate(fs);
+		return CommitJournal(fs);
+
+}
+
+
+int fs_delete_h(fs_t *fs, const char *filename)
+{
+		STATS_OP(FS_OP_DELETE);
+		// check if FS is not mount, filename invalid
+		if(FileCheck(fs, filename) == -1){
+				return -1;
+		}
+		BeginMetadataUpdate(fs);
+		pthread_rwlock_wrlock(&fs->rootLock);
+		// check if file not exist
+		// if the file is open, return -1
+		int indexOfRootDirectory = FindFileLocation(fs, filename);
+		if(indexOfRootDirectory < 0 || fs->numOfOpenFds[indexOfRootDirectory] != 0){
+				pthread_rwlock_unlock(&fs->rootLock);
+				EndMetadataUpdate(fs);
+				return -1;
+		}
+		RemoveFileFromIndex(fs, indexOfRootDirectory);
+		// set the size of file to 0
+		fs->RootDirectory[indexOfRootDirectory].sizeOfFile = 0;
+		// clean the filename inside root directory
+		for(int i = 0; i < FS_FILENAME_LEN; i++){
+				strcpy(fs->RootDirectory[indexOfRootDirectory].filename + i, "\0");
+		}
+		uint32_t indexOfFat = GetFirstBlock(fs, &fs->RootDirectory[indexOfRootDirectory]);
+		SetFirstBlock(fs, &fs->RootDirectory[indexOfRootDirectory], FAT_EOC);
+		MarkRootEntryDirty(fs, indexOfRootDirectory);
+		pthread_rwlock_unlock(&fs->rootLock);
+		// set the fat block belong to this file to 0
+		// nothing can reach them anymore, so the root directory lock is not needed
+		pthread_mutex_lock(&fs->fatLock);
+		while(indexOfFat != FAT_EOC){
+				uint32_t nextFat = GetFatEntry(fs, indexOfFat);
+				// the blocks left are lost, but never reused while still chained
+				if(SetFatEntry(fs, indexOfFat, 0)){
+						break;
+				}
+				indexOfFat = nextFat;
+		}
+		pthread_mutex_unlock(&fs->fatLock);
+		EndMetadataUpdate(fs);
+		return CommitJournal(fs);
+}
+
+int fs_ls_h(fs_t *fs)
+{
+		STATS_OP(FS_OP_LS);
+		if(fs == NULL || fs->isMounted == UNMOUNTED){
+				return -1;
+		}
+		// every root directory block is needed
+		pthread_rwlock_rdlock(&fs->rootLock);
+		if(LoadAllRootBlocks(fs)){
+				pthread_rwlock_unlock(&fs->rootLock);
+				return -1;
+		}
+		printf("FS Ls:\n");
+		for(int i = 0; i < fs->numOfRootEntries; i++){
+				if(strlen(fs->RootDirectory[i].filename) != 0){
+						printf("file: %s, ", fs->RootDirectory[i].filename);
+						printf("size: %d, ", fs->RootDirectory[i].sizeOfFile);
+						// printed as stored on disk, so an empty file shows 65535 in the original format
+						uint32_t firstBlock = GetFirstBlock(fs, &fs->RootDirectory[i]);
+						if(fs->sizeOfFatEntry == sizeof(uint16_t)){
+								firstBlock = (uint16_t)firstBlock;
+						}
+						printf("data_blk: %u\n", firstBlock);
+				}
+		}
+		pthread_rwlock_unlock(&fs->rootLock);
+		return 0;
+}
+
+int AppendToChain(OpenFile *openFile, uint32_t indexOfFat){
+		if(openFile->chainLength == openFile->chainCapacity){
+				int capacity = openFile->chainCapacity ? openFile->chainCapacity * 2 : 16;
+				uint32_t *chain = (uint32_t*)realloc(openFile->chain, sizeof(uint32_t) * capacity);
+				if(chain == NULL){
+						return -1;
+				}
+				openFile->chain = chain;
+				openFile->chainCapacity = capacity;
+		}
+		openFile->chain[openFile->chainLength] = indexOfFat;
+		openFile->chainLength += 1;
+		return 0;
+}
+
+void InvalidateChain(OpenFile *openFile){
+		openFile->chainLength = 0;
+		openFile->isChainValid = 0;
+}
+
+int LoadChain(FileSystem *fs, OpenFile *openFile){
+		// walk the FAT chain once, then block #i of the file is chain[i]
+		if(openFile->isChainValid){
+				return 0;
+		}
+		STATS_OP(FS_OP_FAT_WALK);
+		InvalidateChain(openFile);
+		pthread_mutex_lock(&fs->fatLock);
+		uint32_t indexOfFat = GetFirstBlock(fs, openFile->file);
+		while(indexOfFat != FAT_EOC && openFile->chainLength < fs->numOfDataBlock){
+				// a fat block that cannot be read would cut the chain short
+				if(LoadFatBlock(fs, indexOfFat / fs->numOfFatEntries) || AppendToChain(openFile, indexOfFat)){
+						InvalidateChain(openFile);
+						pthread_mutex_unlock(&fs->fatLock);
+						return -1;
+				}
+				indexOfFat = GetFatEntry(fs, indexOfFat);
+		}
+		pthread_mutex_unlock(&fs->fatLock);
+		openFile->isChainValid = 1;
+		return 0;
+}
+
+void ResetReadahead(OpenFile *openFile){
+		openFile->sequentialOffset = 0;
+		openFile->readaheadBlocks = 0;
+		openFile->readaheadEnd = 0;
+}
+
+int fs_open_h(fs_t *fs, const char *filename)
+{
+		STATS_OP(FS_OP_OPEN);
+		if(FileCheck(fs, filename) == -1){
+				return -1;
+		}
+		pthread_rwlock_rdlock(&fs->rootLock);
+		int indexOfFile = FindFileLocation(fs, filename);
+		pthread_mutex_lock(&fs->fdTableLock);
+		if(indexOfFile < 0 || fs->freeFdBitmap == 0){
+				pthread_mutex_unlock(&fs->fdTableLock);
+				pthread_rwlock_unlock(&fs->rootLock);
+				return -1;
+		}
+		// take the lowest unused fd, the file cannot be deleted while it is open
+		int fd = __builtin_ctzll(fs->freeFdBitmap);
+		fs->freeFdBitmap &= ~((uint64_t)1 << fd);
+		fs->numOfOpenFds[indexOfFile] += 1;
+		fs->numOfOpenFiles += 1;
+		pthread_mutex_unlock(&fs->fdTableLock);
+		pthread_rwlock_unlock(&fs->rootLock);
+		// then point the fd at the root directory entry
+		OpenFile *openFile = &fs->openFiles[fd];
+		pthread_mutex_lock(&openFile->lock);
+		pthread_rwlock_wrlock(FileLock(fs, indexOfFile));
+		openFile->file = &fs->RootDirectory[indexOfFile];
+		openFile->indexOfRootDirectory = indexOfFile;
+		openFile->offset = 0;
+		ResetReadahead(openFile);
+		fs->fdsOfFile[indexOfFile] |= (uint64_t)1 << fd;
+		pthread_rwlock_unlock(FileLock(fs, indexOfFile));
+		pthread_mutex_unlock(&openFile->lock);
+		return fd;
+}
+
+OpenFile *FdCheck(FileSystem *fs, int fd, int isWrite){
+		// return the open file with the fd locked, and the file locked for
+		// reading or writing, until UnlockFd(fs) is called
+		if(fs == NULL || fs->isMounted == UNMOUNTED){
+				return NULL;
+		}
+		if(fd < 0 || fd >= FS_OPEN_MAX_COUNT){
+				return NULL;
+		}
+		OpenFile *openFile = &fs->openFiles[fd];
+		pthread_mutex_lock(&openFile->lock);
+		// NULL if the fd is not currently open
+		if(openFile->file == NULL){
+				pthread_mutex_unlock(&openFile->lock);
+				return NULL;
+		}
+		if(isWrite){
+				pthread_rwlock_wrlock(FileLock(fs, openFile->indexOfRootDirectory));
+		}else{
+				pthread_rwlock_rdlock(FileLock(fs, openFile->indexOfRootDirectory));
+		}
+		return openFile;
+}
+
+void UnlockFd(FileSystem *fs, OpenFile *openFile){
+		pthread_rwlock_unlock(FileLock(fs, openFile->indexOfRootDirectory));
+		pthread_mutex_unlock(&openFile->lock);
+}
+
+uint64_t ClampOffset(OpenFile *openFile){
+		// the file may have been truncated through another fd
+		if(openFile->offset > (uint64_t)openFile->file->sizeOfFile){
+				openFile->offset = openFile->file->sizeOfFile;
+		}
+		return openFile->offset;
+}
+
+int fs_close_h(fs_t *fs, int fd)
+{
+	STATS_OP(FS_OP_CLOSE);
+	// check fd
+	// (including check if fs is mount, fd>32, file not exist)
+	OpenFile *openFile = FdCheck(fs, fd, 1);
+	if(openFile == NULL){
+		return -1;
+	}
+	// release the fd
+	int indexOfFile = openFile->indexOfRootDirectory;
+	fs->fdsOfFile[indexOfFile] &= ~((uint64_t)1 << fd);
+	openFile->file = NULL;
+	openFile->offset = 0;
+	free(openFile->chain);
+	openFile->chain = NULL;
+	openFile->chainCapacity = 0;
+	InvalidateChain(openFile);
+	UnlockFd(fs, openFile);
+	// then its reference on the file
+	pthread_rwlock_rdlock(&fs->rootLock);
+	pthread_mutex_lock(&fs->fdTableLock);
+	fs->numOfOpenFds[indexOfFile] -= 1;
+	fs->freeFdBitmap |= (uint64_t)1 << fd;
+	fs->numOfOpenFiles -= 1;
+	pthread_mutex_unlock(&fs->fdTableLock);
+	pthread_rwlock_unlock(&fs->rootLock);
+	// what was written through the fd is durable once it is closed
+	return CommitJournal(fs);
+}
+
+int fs_stat_h(fs_t *fs, int fd)
+{
+	STATS_OP(FS_OP_STAT);
+	OpenFile *openFile = FdCheck(fs, fd, 0);
+	if(openFile == NULL){
+		return -1;
+	}
+	int sizeOfFile = openFile->file->sizeOfFile;
+	UnlockFd(fs, openFile);
+	return sizeOfFile;
+}
+
+int fs_lseek_h(fs_t *fs, int fd, size_t offset)
+{
+	STATS_OP(FS_OP_LSEEK);
+	OpenFile *openFile = FdCheck(fs, fd, 0);
+	if(openFile == NULL){
+		return -1;
+	}
+	// offset cannot be larger than the file size
+	if((size_t)openFile->file->sizeOfFile < offset){
+		UnlockFd(fs, openFile);
+		return -1;
+	}
+	// move to the new offset
+	openFile->offset = offset;
+	UnlockFd(fs, openFile);
+	return 0;
+}
+
+int ExtendFile(FileSystem *fs, OpenFile *openFile, int numOfBlocks){
+		STATS_OP(FS_OP_ALLOC);
+		// make the FAT chain of the file at least numOfBlocks blocks long
+		// return the final length, which is shorter if the disk is full
+		// or -1 if a fat block cannot be read
+		if(LoadChain(fs, openFile)){
+				return -1;
+		}
+		int lengthOfRun = 0;
+		int indexOfUnusedFatBlock = -1;
+		pthread_mutex_lock(&fs->fatLock);
+		while(openFile->chainLength < numOfBlocks){
+				int numOfMissingBlocks = numOfBlocks - openFile->chainLength;
+				if(lengthOfRun == 0){
+						// keep the file contiguous: first grow it in place if the
+						// next block is free, otherwise take a run that fits
+						// small allocations just take the next free block and the
+						// ones following it, which is cheaper
+						int lastFat = openFile->chainLength ? (int)openFile->chain[openFile->chainLength - 1] : -1;
+						int nextFat = -2;
+						if(lastFat != -1 && lastFat + 1 < fs->numOfDataBlock){
+								nextFat = NextFatLocation(fs, lastFat + 1, 1);
+								if(nextFat == -1){
+										pthread_mutex_unlock(&fs->fatLock);
+										return -1;
+								}
+						}
+						indexOfUnusedFatBlock = -1;
+						if(nextFat == lastFat + 1){
+								indexOfUnusedFatBlock = nextFat;
+						}else if(numOfMissingBlocks > FS_SMALL_ALLOCATION_BLOCKS){
+								indexOfUnusedFatBlock = FindFreeRun(fs, numOfMissingBlocks, &lengthOfRun);
+						}
+						if(indexOfUnusedFatBlock == -1){
+								indexOfUnusedFatBlock = NextFreeLocation(fs);
+						}
+						if(indexOfUnusedFatBlock == -2){
+								pthread_mutex_unlock(&fs->fatLock);
+								return -1;
+						}
+						if(indexOfUnusedFatBlock == -1){
+								break;
+						}
+						if(lengthOfRun == 0){
+								lengthOfRun = fs->freeRunOther[StartOfFreeRun(fs, indexOfUnusedFatBlock)] - indexOfUnusedFatBlock + 1;
+						}
+						if(lengthOfRun > numOfMissingBlocks){
+								lengthOfRun = numOfMissingBlocks;
+						}
+				}else{
+						indexOfUnusedFatBlock += 1;
+				}
+				lengthOfRun -= 1;
+				// the block is only linked once it is marked as the end of the chain
+				if(SetFatEntry(fs, indexOfUnusedFatBlock, FAT_EOC)){
+						pthread_mutex_unlock(&fs->fatLock);
+						return -1;
+				}
+				if(openFile->chainLength == 0){
+						pthread_rwlock_wrlock(&fs->rootLock);
+						SetFirstBlock(fs, openFile->file, indexOfUnusedFatBlock);
+						MarkRootEntryDirty(fs, openFile->indexOfRootDirectory);
+						pthread_rwlock_unlock(&fs->rootLock);
+				}else if(SetFatEntry(fs, openFile->chain[openFile->chainLength - 1], indexOfUnusedFatBlock)){
+						SetFatEntry(fs, indexOfUnusedFatBlock, 0);
+						pthread_mutex_unlock(&fs->fatLock);
+						return -1;
+				}
+				// keep the chain of every fd open on this file up to date
+				for(uint64_t fds = fs->fdsOfFile[openFile->indexOfRootDirectory]; fds != 0; fds &= fds - 1){
+						OpenFile *other = &fs->openFiles[__builtin_ctzll(fds)];
+						if(other->isChainValid && AppendToChain(other, indexOfUnusedFatBlock)){
+								InvalidateChain(other);
+						}
+				}
+				if(!openFile->isChainValid){
+						pthread_mutex_unlock(&fs->fatLock);
+						return -1;
+				}
+		}
+		pthread_mutex_unlock(&fs->fatLock);
+		return openFile->chainLength;
+}
+
+void ShrinkFile(FileSystem *fs, OpenFile *openFile, int numOfBlocks){
+		// cut the FAT chain of the file (already loaded) to numOfBlocks blocks
+		if(openFile->chainLength <= numOfBlocks){
+				return;
+		}
+		pthread_mutex_lock(&fs->fatLock);
+		if(numOfBlocks == 0){
+				pthread_rwlock_wrlock(&fs->rootLock);
+				SetFirstBlock(fs, openFile->file, FAT_EOC);
+				MarkRootEntryDirty(fs, openFile->indexOfRootDirectory);
+				pthread_rwlock_unlock(&fs->rootLock);
+		}else{
+				SetFatEntry(fs, openFile->chain[numOfBlocks - 1], FAT_EOC);
+		}
+		for(int i = numOfBlocks; i < openFile->chainLength; i++){
+				SetFatEntry(fs, openFile->chain[i], 0);
+		}
+		pthread_mutex_unlock(&fs->fatLock);
+		// the chain of every fd open on this file is a prefix of this one
+		for(uint64_t fds = fs->fdsOfFile[openFile->indexOfRootDirectory]; fds != 0; fds &= fds - 1){
+				OpenFile *other = &fs->openFiles[__builtin_ctzll(fds)];
+				if(other->chainLength > numOfBlocks){
+						other->chainLength = numOfBlocks;
+				}
+		}
+}
+
+int TransferBlocks(FileSystem *fs, uint32_t *blocks, int numOfBlocks, void *buffer, int isWrite){
+		// each run of physically contiguous data blocks is one request
+		// and all the requests are submitted to the disk together
+		struct disk_request *requests = (struct disk_request*)malloc(sizeof(struct disk_request) * numOfBlocks);
+		if(requests == NULL){
+				return -1;
+		}
+		int numOfRequests = 0;
+		int start = 0;
+		for(int i = 1; i <= numOfBlocks; i++){
+				if(i < numOfBlocks && blocks[i] == blocks[i - 1] + 1){
+						continue;
+				}
+				requests[numOfRequests].block = fs->indexOfStartBlock + blocks[start];
+				requests[numOfRequests].count = i - start;
+				requests[numOfRequests].buf = (char*)buffer + (size_t)start * fs->sizeOfBlock;
+				requests[numOfRequests].is_write = isWrite;
+				numOfRequests += 1;
+				start = i;
+		}
+		int ret = cache_submit(fs->cache, requests, numOfRequests);
+		free(requests);
+		return ret;
+}
+
+typedef struct{
+		// buffers of the caller, and the position reached in them
+		const struct iovec *iov;
+		int iovcnt;
+		int indexOfSegment;
+		size_t offsetInSegment;
+}IoVector;
+
+void InitIoVector(IoVector *vector, const struct iovec *iov, int iovcnt){
+		vector->iov = iov;
+		vector->iovcnt = iovcnt;
+		vector->indexOfSegment = 0;
+		vector->offsetInSegment = 0;
+}
+
+int InitBuffer(IoVector *vector, struct iovec *iov){
+		// a single buffer is a vector of one segment
+		InitIoVector(vector, iov, 1);
+		return iov->iov_base == NULL ? -1 : 0;
+}
+
+char *IoVectorSpan(IoVector *vector, size_t *size){
+		// the contiguous bytes left in the buffer at the position reached
+		while(vector->indexOfSegment < vector->iovcnt
+				&& vector->offsetInSegment == vector->iov[vector->indexOfSegment].iov_len){
+				vector->indexOfSegment += 1;
+				vector->offsetInSegment = 0;
+		}
+		if(vector->indexOfSegment == vector->iovcnt){
+				*size = 0;
+				return NULL;
+		}
+		*size = vector->iov[vector->indexOfSegment].iov_len - vector->offsetInSegment;
+		return (char*)vector->iov[vector->indexOfSegment].iov_base + vector->offsetInSegment;
+}
+
+void CopyIoVector(IoVector *vector, char *block, size_t size, int isWrite){
+		// copy size bytes from the buffers to block if isWrite, the other way
+		// otherwise, and move the position past them
+		while(size > 0){
+				size_t sizeInSegment;
+				char *segment = IoVectorSpan(vector, &sizeInSegment);
+				if(sizeInSegment > size){
+						sizeInSegment = size;
+				}
+				if(isWrite){
+						memcpy(block, segment, sizeInSegment);
+				}else{
+						memcpy(segment, block, sizeInSegment);
+				}
+				block += sizeInSegment;
+				size -= sizeInSegment;
+				vector->offsetInSegment += sizeInSegment;
+		}
+}
+
+size_t CopyFromMappedBlocks(FileSystem *fs, uint32_t *blocks, int numOfBlocks, int startOffsetInBlock, IoVector *vector, size_t count){
+		// copy count bytes starting at startOffsetInBlock in the first block
+		size_t actualSize = 0;
+		for(int i = 0; i < numOfBlocks && actualSize < count; i++){
+				char *block = disk_ptr(fs->disk, fs->indexOfStartBlock + blocks[i]);
+				if(block == NULL){
+						break;
+				}
+				size_t sizeInBlock = fs->sizeOfBlock - startOffsetInBlock;
+				if(sizeInBlock > count - actualSize){
+						sizeInBlock = count - actualSize;
+				}
+				CopyIoVector(vector, block + startOffsetInBlock, sizeInBlock, 0);
+				actualSize += sizeInBlock;
+				startOffsetInBlock = 0;
+		}
+		return actualSize;
+}
+
+size_t ReadFromBlocks(FileSystem *fs, char *scratchBlock, uint32_t *blocks, int startOffsetInBlock, IoVector *vector, size_t count){
+		// whole blocks go straight to the caller's buffers
+		// only partial ones at the head and tail, and the ones that straddle
+		// two buffers, go through the scratch block
+		size_t actualSize = 0;
+		int i = 0;
+		while(actualSize < count){
+				size_t sizeInBlock = fs->sizeOfBlock - startOffsetInBlock;
+				if(sizeInBlock > count - actualSize){
+						sizeInBlock = count - actualSize;
+				}
+				size_t sizeInSegment;
+				char *segment = IoVectorSpan(vector, &sizeInSegment);
+				if(sizeInSegment > count - actualSize){
+						sizeInSegment = count - actualSize;
+				}
+				if(sizeInBlock == (size_t)fs->sizeOfBlock && sizeInSegment >= (size_t)fs->sizeOfBlock){
+						int numOfWholeBlocks = sizeInSegment / fs->sizeOfBlock;
+						if(TransferBlocks(fs, blocks + i, numOfWholeBlocks, segment, 0)){
+								break;
+						}
+						i += numOfWholeBlocks;
+						actualSize += (size_t)numOfWholeBlocks * fs->sizeOfBlock;
+						vector->offsetInSegment += (size_t)numOfWholeBlocks * fs->sizeOfBlock;
+				}else{
+						if(cache_read(fs->cache, fs->indexOfStartBlock + blocks[i], scratchBlock)){
+								break;
+						}
+						CopyIoVector(vector, scratchBlock + startOffsetInBlock, sizeInBlock, 0);
+						i += 1;
+						actualSize += sizeInBlock;
+				}
+				startOffsetInBlock = 0;
+		}
+		return actualSize;
+}
+
+size_t WriteToBlocks(FileSystem *fs, char *scratchBlock, uint32_t *blocks, uint64_t offsetOfFile, uint64_t sizeOfFile, IoVector *vector, size_t count){
+		// whole blocks are written straight from the caller's buffers
+		// only partial ones at the head and tail are read, modified and written
+		// and the whole ones that straddle two buffers gathered first
+		int startOffsetInBlock = offsetOfFile % fs->sizeOfBlock;
+		uint64_t offsetOfBlock = offsetOfFile - startOffsetInBlock;
+		size_t actualSize = 0;
+		int i = 0;
+		while(actualSize < count){
+				size_t sizeInBlock = fs->sizeOfBlock - startOffsetInBlock;
+				if(sizeInBlock > count - actualSize){
+						sizeInBlock = count - actualSize;
+				}
+				size_t sizeInSegment;
+				char *segment = IoVectorSpan(vector, &sizeInSegment);
+				if(sizeInSegment > count - actualSize){
+						sizeInSegment = count - actualSize;
+				}
+				if(sizeInBlock == (size_t)fs->sizeOfBlock && sizeInSegment >= (size_t)fs->sizeOfBlock){
+						int numOfWholeBlocks = sizeInSegment / fs->sizeOfBlock;
+						if(TransferBlocks(fs, blocks + i, numOfWholeBlocks, segment, 1)){
+								break;
+						}
+						i += numOfWholeBlocks;
+						actualSize += (size_t)numOfWholeBlocks * fs->sizeOfBlock;
+						vector->offsetInSegment += (size_t)numOfWholeBlocks * fs->sizeOfBlock;
+				}else{
+						size_t indexOfBlock = fs->indexOfStartBlock + blocks[i];
+						// a block written whole, or past the end of the file, has
+						// nothing worth reading
+						if(sizeInBlock < (size_t)fs->sizeOfBlock){
+								if(offsetOfBlock + (uint64_t)i * fs->sizeOfBlock < sizeOfFile){
+										if(cache_read(fs->cache, indexOfBlock, scratchBlock)){
+												break;
+										}
+								}else{
+										memset(scratchBlock, 0, fs->sizeOfBlock);
+								}
+						}
+						CopyIoVector(vector, scratchBlock + startOffsetInBlock, sizeInBlock, 1);
+						if(cache_write(fs->cache, indexOfBlock, scratchBlock)){
+								break;
+						}
+						i += 1;
+						actualSize += sizeInBlock;
+				}
+				startOffsetInBlock = 0;
+		}
+		// only once the blocks are in the cache, so that the next commit flushes them
+		if(actualSize > 0){
+				__atomic_store_n(&fs->isDataWritten, 1, __ATOMIC_RELEASE);
+		}
+		return actualSize;
+}
+
+size_t ZeroFileRange(FileSystem *fs, OpenFile *openFile, uint64_t offsetOfFile, uint64_t endOfRange){
+		// fill [offsetOfFile, endOfRange) of the file, whose blocks are allocated, with zeros
+		uint64_t sizeOfFile = openFile->file->sizeOfFile;
+		uint64_t current = offsetOfFile;
+		while(current < endOfRange){
+				int startOffsetInBlock = current % fs->sizeOfBlock;
+				size_t sizeInBlock = fs->sizeOfBlock - startOffsetInBlock;
+				if(sizeInBlock > endOfRange - current){
+						sizeInBlock = endOfRange - current;
+				}
+				struct iovec zeros = {fs->zeroBlock, sizeInBlock};
+				IoVector vector;
+				InitIoVector(&vector, &zeros, 1);
+				if(WriteToBlocks(fs, openFile->scratchBlock, openFile->chain + current / fs->sizeOfBlock, current, sizeOfFile,
+						&vector, sizeInBlock) != sizeInBlock){
+						break;
+				}
+				current += sizeInBlock;
+		}
+		return current - offsetOfFile;
+}
+
+int WriteFileAt(FileSystem *fs, OpenFile *openFile, uint64_t offsetOfFile, IoVector *vector, size_t count)
+{
+		// called with the fd locked and the file locked for writing
+		// offsetOfFile is at most the file size, the fd offset is left alone
+		if(count == 0){
+				return -1;
+		}
+		// the size of the file must fit in its root directory entry
+		if(count > INT32_MAX - offsetOfFile){
+				count = INT32_MAX - offsetOfFile;
+				if(count == 0){
+						return 0;
+				}
+		}
+		//range of file blocks covered by the write
+		int firstBlockOfFile = offsetOfFile / fs->sizeOfBlock;
+		int startOffsetInBlock = offsetOfFile % fs->sizeOfBlock;
+		int numOfBlocks = (startOffsetInBlock + count + fs->sizeOfBlock - 1) / fs->sizeOfBlock;
+		//allocate the missing blocks, write as much as possible if disk is full
+		BeginMetadataUpdate(fs);
+		int numOfFileBlocks = ExtendFile(fs, openFile, firstBlockOfFile + numOfBlocks);
+		EndMetadataUpdate(fs);
+		if(numOfFileBlocks == -1){
+				return -1;
+		}
+		if(numOfFileBlocks <= firstBlockOfFile){
+				return 0;
+		}
+		if(numOfFileBlocks < firstBlockOfFile + numOfBlocks){
+				numOfBlocks = numOfFileBlocks - firstBlockOfFile;
+				count = (size_t)numOfBlocks * fs->sizeOfBlock - startOffsetInBlock;
+		}
+		uint32_t *blocks = openFile->chain + firstBlockOfFile;
+		int actualSize = WriteToBlocks(fs, openFile->scratchBlock, blocks, offsetOfFile, openFile->file->sizeOfFile, vector, count);
+		if(offsetOfFile + actualSize > (uint64_t)openFile->file->sizeOfFile){
+				BeginMetadataUpdate(fs);
+				pthread_rwlock_wrlock(&fs->rootLock);
+				openFile->file->sizeOfFile = offsetOfFile + actualSize;
+				MarkRootEntryDirty(fs, openFile->indexOfRootDirectory);
+				pthread_rwlock_unlock(&fs->rootLock);
+				EndMetadataUpdate(fs);
+		}
+		return actualSize;
+
+}
+
+int WriteFile(FileSystem *fs, OpenFile *openFile, IoVector *vector, size_t count)
+{
+		int ret = WriteFileAt(fs, openFile, ClampOffset(openFile), vector, count);
+		if(ret > 0){
+				openFile->offset += ret;
+		}
+		return ret;
+}
+
+int fs_write_h(fs_t *fs, int fd, void *buf, size_t count)
+{
+		STATS_OP(FS_OP_WRITE);
+		struct iovec iov = {buf, count};
+		IoVector vector;
+		if(InitBuffer(&vector, &iov)){
+				return -1;
+		}
+		OpenFile *openFile = FdCheck(fs, fd, 1);
+		if(openFile == NULL){
+				return -1;
+		}
+		int ret = WriteFile(fs, openFile, &vector, count);
+		UnlockFd(fs, openFile);
+		STATS_BYTES(ret);
+		return ret;
+}
+
+void ReadAhead(FileSystem *fs, OpenFile *openFile, uint64_t offsetOfFile, size_t count){
+		// called with the chain loaded, after reading [offsetOfFile, offsetOfFile + count)
+		if(fs->maxReadahead == 0){
+				return;
+		}
+		// any read that does not continue the previous one starts over
+		if(offsetOfFile != openFile->sequentialOffset){
+				openFile->readaheadBlocks = 0;
+				openFile->readaheadEnd = 0;
+				return;
+		}
+		// nothing to do until the read reaches the last block read ahead
+		int lastBlockOfFile = (offsetOfFile + count - 1) / fs->sizeOfBlock;
+		if(lastBlockOfFile + 1 < openFile->readaheadEnd){
+				return;
+		}
+		// double the window each time the reads catch up with it
+		// and read ahead at least as much as the reads ask for
+		int firstBlockOfFile = offsetOfFile / fs->sizeOfBlock;
+		int numOfBlocks = openFile->readaheadBlocks * 2;
+		if(numOfBlocks < FS_READAHEAD_MIN_BLOCKS){
+				numOfBlocks = FS_READAHEAD_MIN_BLOCKS;
+		}
+		if(numOfBlocks < lastBlockOfFile + 1 - firstBlockOfFile){
+				numOfBlocks = lastBlockOfFile + 1 - firstBlockOfFile;
+		}
+		if(numOfBlocks > fs->maxReadahead){
+				numOfBlocks = fs->maxReadahead;
+		}
+		int start = lastBlockOfFile + 1;
+		if(start < openFile->readaheadEnd){
+				start = openFile->readaheadEnd;
+		}
+		// stop at the end of the file, its other blocks have nothing to read
+		int numOfFileBlocks = ((uint64_t)openFile->file->sizeOfFile + fs->sizeOfBlock - 1) / fs->sizeOfBlock;
+		if(numOfFileBlocks > openFile->chainLength){
+				numOfFileBlocks = openFile->chainLength;
+		}
+		int end = start + numOfBlocks;
+		if(end > numOfFileBlocks){
+				end = numOfFileBlocks;
+		}
+		openFile->readaheadBlocks = numOfBlocks;
+		openFile->readaheadEnd = end;
+		if(start >= end){
+				return;
+		}
+		size_t *blocks = (size_t*)malloc(sizeof(size_t) * (end - start));
+		if(blocks == NULL){
+				return;
+		}
+		for(int i = start; i < end; i++){
+				blocks[i - start] = fs->indexOfStartBlock + openFile->chain[i];
+		}
+		// a failed prefetch only costs the later reads a trip to the disk
+		cache_prefetch(fs->cache, blocks, end - start);
+		free(blocks);
+}
+
+int ReadFileAt(FileSystem *fs, OpenFile *openFile, uint64_t offsetOfFile, IoVector *vector, size_t count)
+{
+		// called with the fd locked and the file locked for reading
+		// offsetOfFile is at most the file size, the fd offset is left alone
+		if(count == 0){
+				return -1;
+		}
+		uint64_t sizeOfFile = openFile->file->sizeOfFile;
+		//cannot read past the end of the file
+		if(count > sizeOfFile - offsetOfFile){
+				count = sizeOfFile - offsetOfFile;
+		}
+		if(count == 0){
+				return 0;
+		}
+		int firstBlockOfFile = offsetOfFile / fs->sizeOfBlock;
+		int startOffsetInBlock = offsetOfFile % fs->sizeOfBlock;
+		int numOfBlocks = (startOffsetInBlock + count + fs->sizeOfBlock - 1) / fs->sizeOfBlock;
+		//find the data blocks of the range without walking the FAT
+		if(LoadChain(fs, openFile) || openFile->chainLength < firstBlockOfFile + numOfBlocks){
+				return -1;
+		}
+		uint32_t *blocks = openFile->chain + firstBlockOfFile;
+		int actualSize;
+		if(fs->diskBackend == FS_DISK_MMAP){
+				// copy straight from the mapped disk into the caller's buffer
+				actualSize = CopyFromMappedBlocks(fs, blocks, numOfBlocks, startOffsetInBlock, vector, count);
+		}else{
+				actualSize = ReadFromBlocks(fs, openFile->scratchBlock, blocks, startOffsetInBlock, vector, count);
+				if(actualSize > 0){
+						ReadAhead(fs, openFile, offsetOfFile, actualSize);
+				}
+		}
+		openFile->sequentialOffset = offsetOfFile + actualSize;
 		return actualSize;
 }
+
+int ReadFile(FileSystem *fs, OpenFile *openFile, IoVector *vector, size_t count)
+{
+		int ret = ReadFileAt(fs, openFile, ClampOffset(openFile), vector, count);
+		if(ret > 0){
+				openFile->offset += ret;
+		}
+		return ret;
+}
+
+int fs_read_h(fs_t *fs, int fd, void *buf, size_t count)
+{
+		STATS_OP(FS_OP_READ);
+		struct iovec iov = {buf, count};
+		IoVector vector;
+		if(InitBuffer(&vector, &iov)){
+				return -1;
+		}
+		OpenFile *openFile = FdCheck(fs, fd, 0);
+		if(openFile == NULL){
+				return -1;
+		}
+		int ret = ReadFile(fs, openFile, &vector, count);
+		UnlockFd(fs, openFile);
+		STATS_BYTES(ret);
+		return ret;
+}
+
+int fs_pwrite_h(fs_t *fs, int fd, void *buf, size_t count, size_t offset)
+{
+		STATS_OP(FS_OP_PWRITE);
+		struct iovec iov = {buf, count};
+		IoVector vector;
+		if(InitBuffer(&vector, &iov)){
+				return -1;
+		}
+		OpenFile *openFile = FdCheck(fs, fd, 1);
+		if(openFile == NULL){
+				return -1;
+		}
+		// same rule as fs_lseek, no write past the end of the file
+		if(offset > (size_t)openFile->file->sizeOfFile){
+				UnlockFd(fs, openFile);
+				return -1;
+		}
+		int ret = WriteFileAt(fs, openFile, offset, &vector, count);
+		UnlockFd(fs, openFile);
+		STATS_BYTES(ret);
+		return ret;
+}
+
+int fs_pread_h(fs_t *fs, int fd, void *buf, size_t count, size_t offset)
+{
+		STATS_OP(FS_OP_PREAD);
+		struct iovec iov = {buf, count};
+		IoVector vector;
+		if(InitBuffer(&vector, &iov)){
+				return -1;
+		}
+		OpenFile *openFile = FdCheck(fs, fd, 0);
+		if(openFile == NULL){
+				return -1;
+		}
+		if(offset > (size_t)openFile->file->sizeOfFile){
+				UnlockFd(fs, openFile);
+				return -1;
+		}
+		int ret = ReadFileAt(fs, openFile, offset, &vector, count);
+		UnlockFd(fs, openFile);
+		STATS_BYTES(ret);
+		return ret;
+}
+
+int TransferVector(FileSystem *fs, int fd, const struct iovec *iov, int iovcnt, int isWrite){
+		// the segments are handled as one contiguous transfer, walked in place
+		// against the blocks of the file, so the blocks they cover are walked,
+		// read and written only once
+		if(iov == NULL || iovcnt <= 0){
+				return -1;
+		}
+		size_t count = 0;
+		for(int i = 0; i < iovcnt; i++){
+				if(iov[i].iov_base == NULL && iov[i].iov_len != 0){
+						return -1;
+				}
+				// no more than a file can hold, which the return value can count
+				if(iov[i].iov_len > INT32_MAX - count){
+						count = INT32_MAX;
+				}else{
+						count += iov[i].iov_len;
+				}
+		}
+		OpenFile *openFile = FdCheck(fs, fd, isWrite);
+		if(openFile == NULL){
+				return -1;
+		}
+		IoVector vector;
+		InitIoVector(&vector, iov, iovcnt);
+		int ret;
+		if(isWrite){
+				ret = WriteFile(fs, openFile, &vector, count);
+		}else{
+				ret = ReadFile(fs, openFile, &vector, count);
+		}
+		UnlockFd(fs, openFile);
+		return ret;
+}
+
+int fs_writev_h(fs_t *fs, int fd, const struct iovec *iov, int iovcnt)
+{
+		STATS_OP(FS_OP_WRITEV);
+		int ret = TransferVector(fs, fd, iov, iovcnt, 1);
+		STATS_BYTES(ret);
+		return ret;
+}
+
+int fs_readv_h(fs_t *fs, int fd, const struct iovec *iov, int iovcnt)
+{
+		STATS_OP(FS_OP_READV);
+		int ret = TransferVector(fs, fd, iov, iovcnt, 0);
+		STATS_BYTES(ret);
+		return ret;
+}
+
+int AllocateFile(FileSystem *fs, OpenFile *openFile, size_t len)
+{
+		// called with the fd locked and the file locked for writing
+		if(len > INT32_MAX){
+				return -1;
+		}
+		if(LoadChain(fs, openFile)){
+				return -1;
+		}
+		// reserve the blocks as contiguous runs, without changing the file size
+		int numOfBlocks = (len + fs->sizeOfBlock - 1) / fs->sizeOfBlock;
+		int numOfFileBlocks = openFile->chainLength;
+		int ret = 0;
+		BeginMetadataUpdate(fs);
+		if(ExtendFile(fs, openFile, numOfBlocks) < numOfBlocks){
+				// not enough space: give back what was reserved
+				if(LoadChain(fs, openFile) == 0){
+						ShrinkFile(fs, openFile, numOfFileBlocks);
+				}
+				ret = -1;
+		}
+		EndMetadataUpdate(fs);
+		return ret;
+}
+
+typedef struct{
+		FileSystem *fs;
+		int fd;
+		void *buf;
+		size_t count;
+		int isWrite;
+		fs_callback_t callback;
+		void *arg;
+}AsyncRequest;
+
+void RunAsyncRequest(void *arg){
+		// run by one of the worker threads
+		AsyncRequest *request = (AsyncRequest*)arg;
+		int ret;
+		if(request->isWrite){
+				ret = fs_write_h(request->fs, request->fd, request->buf, request->count);
+		}else{
+				ret = fs_read_h(request->fs, request->fd, request->buf, request->count);
+		}
+		if(request->callback != NULL){
+				request->callback(request->fd, ret, request->arg);
+		}
+		free(request);
+}
+
+int SubmitAsyncRequest(FileSystem *fs, int fd, void *buf, size_t count, int isWrite, fs_callback_t callback, void *arg){
+		if(fs == NULL || fs->isMounted == UNMOUNTED){
+				return -1;
+		}
+		if(fd < 0 || fd >= FS_OPEN_MAX_COUNT){
+				return -1;
+		}
+		AsyncRequest *request = (AsyncRequest*)malloc(sizeof(AsyncRequest));
+		if(request == NULL){
+				return -1;
+		}
+		request->fs = fs;
+		request->fd = fd;
+		request->buf = buf;
+		request->count = count;
+		request->isWrite = isWrite;
+		request->callback = callback;
+		request->arg = arg;
+		// requests on a same fd all move its offset, so they run in order
+		if(async_submit(fs->async, fd, RunAsyncRequest, request)){
+				free(request);
+				return -1;
+		}
+		return 0;
+}
+
+int fs_read_async_h(fs_t *fs, int fd, void *buf, size_t count, fs_callback_t callback, void *arg)
+{
+		STATS_OP(FS_OP_READ_ASYNC);
+		return SubmitAsyncRequest(fs, fd, buf, count, 0, callback, arg);
+}
+
+int fs_write_async_h(fs_t *fs, int fd, void *buf, size_t count, fs_callback_t callback, void *arg)
+{
+		STATS_OP(FS_OP_WRITE_ASYNC);
+		return SubmitAsyncRequest(fs, fd, buf, count, 1, callback, arg);
+}
+
+int fs_async_wait_h(fs_t *fs)
+{
+		STATS_OP(FS_OP_ASYNC_WAIT);
+		if(fs == NULL || fs->isMounted == UNMOUNTED){
+				return -1;
+		}
+		async_drain(fs->async);
+		return 0;
+}
+
+int fs_fallocate_h(fs_t *fs, int fd, size_t len)
+{
+		STATS_OP(FS_OP_FALLOCATE);
+		OpenFile *openFile = FdCheck(fs, fd, 1);
+		if(openFile == NULL){
+				return -1;
+		}
+		int ret = AllocateFile(fs, openFile, len);
+		UnlockFd(fs, openFile);
+		if(ret == 0){
+				ret = CommitJournal(fs);
+		}
+		return ret;
+}
+
+int TruncateFile(FileSystem *fs, OpenFile *openFile, size_t len)
+{
+		// called with the fd locked and the file locked for writing
+		if(len > INT32_MAX){
+				return -1;
+		}
+		if(LoadChain(fs, openFile)){
+				return -1;
+		}
+		uint64_t sizeOfFile = openFile->file->sizeOfFile;
+		int numOfBlocks = (len + fs->sizeOfBlock - 1) / fs->sizeOfBlock;
+		if(len > sizeOfFile){
+				// extend the file with zeros
+				int numOfFileBlocks = openFile->chainLength;
+				BeginMetadataUpdate(fs);
+				if(ExtendFile(fs, openFile, numOfBlocks) < numOfBlocks){
+						if(LoadChain(fs, openFile) == 0){
+								ShrinkFile(fs, openFile, numOfFileBlocks);
+						}
+						EndMetadataUpdate(fs);
+						return -1;
+				}
+				EndMetadataUpdate(fs);
+				if(ZeroFileRange(fs, openFile, sizeOfFile, len) != len - sizeOfFile){
+						return -1;
+				}
+		}
+		// release every block past the new end, preallocated ones included
+		BeginMetadataUpdate(fs);
+		ShrinkFile(fs, openFile, numOfBlocks);
+		pthread_rwlock_wrlock(&fs->rootLock);
+		openFile->file->sizeOfFile = len;
+		MarkRootEntryDirty(fs, openFile->indexOfRootDirectory);
+		pthread_rwlock_unlock(&fs->rootLock);
+		EndMetadataUpdate(fs);
+		// offsets past the new end are moved back to it on their next use
+		ClampOffset(openFile);
+		return 0;
+}
+
+int fs_truncate_h(fs_t *fs, int fd, size_t len)
+{
+		STATS_OP(FS_OP_TRUNCATE);
+		OpenFile *openFile = FdCheck(fs, fd, 1);
+		if(openFile == NULL){
+				return -1;
+		}
+		int ret = TruncateFile(fs, openFile, len);
+		UnlockFd(fs, openFile);
+		if(ret == 0){
+				ret = CommitJournal(fs);
+		}
+		return ret;
+}
+
+// the functions without a handle operate on the file system mounted with fs_mount()
+int fs_mount(const char *diskname)
+{
+		if(defaultFs != NULL){
+				return -1;
+		}
+		defaultFs = fs_mount_h(diskname);
+		return defaultFs == NULL ? -1 : 0;
+}
+
+int fs_umount(void)
+{
+		STATS_OP(FS_OP_UMOUNT);
+		if(PrepareUnmount(defaultFs)){
+				return -1;
+		}
+		// released from here on, whatever happens
+		FileSystem *fs = defaultFs;
+		defaultFs = NULL;
+		return ReleaseFileSystem(fs);
+}
+
+int fs_flush(void)
+{
+		return fs_flush_h(defaultFs);
+}
+
+int fs_sync(void)
+{
+		return fs_sync_h(defaultFs);
+}
+
+int fs_cache_stats(struct fs_cache_stats *stats)
+{
+		return fs_cache_stats_h(defaultFs, stats);
+}
+
+int fs_statfs(struct fs_statfs *stats)
+{
+		return fs_statfs_h(defaultFs, stats);
+}
+
+int fs_info(void)
+{
+		return fs_info_h(defaultFs);
+}
+
+int fs_create(const char *filename)
+{
+		return fs_create_h(defaultFs, filename);
+}
+
+int fs_delete(const char *filename)
+{
+		return fs_delete_h(defaultFs, filename);
+}
+
+int fs_ls(void)
+{
+		return fs_ls_h(defaultFs);
+}
+
+int fs_open(const char *filename)
+{
+		return fs_open_h(defaultFs, filename);
+}
+
+int fs_close(int fd)
+{
+		return fs_close_h(defaultFs, fd);
+}
+
+int fs_stat(int fd)
+{
+		return fs_stat_h(defaultFs, fd);
+}
+
+int fs_lseek(int fd, size_t offset)
+{
+		return fs_lseek_h(defaultFs, fd, offset);
+}
+
+int fs_write(int fd, void *buf, size_t count)
+{
+		return fs_write_h(defaultFs, fd, buf, count);
+}
+
+int fs_read(int fd, void *buf, size_t count)
+{
+		return fs_read_h(defaultFs, fd, buf, count);
+}
+
+int fs_pwrite(int fd, void *buf, size_t count, size_t offset)
+{
+		return fs_pwrite_h(defaultFs, fd, buf, count, offset);
+}
+
+int fs_pread(int fd, void *buf, size_t count, size_t offset)
+{
+		return fs_pread_h(defaultFs, fd, buf, count, offset);
+}
+
+int fs_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+		return fs_writev_h(defaultFs, fd, iov, iovcnt);
+}
+
+int fs_readv(int fd, const struct iovec *iov, int iovcnt)
+{
+		return fs_readv_h(defaultFs, fd, iov, iovcnt);
+}
+
+int fs_read_async(int fd, void *buf, size_t count, fs_callback_t callback, void *arg)
+{
+		return fs_read_async_h(defaultFs, fd, buf, count, callback, arg);
+}
+
+int fs_write_async(int fd, void *buf, size_t count, fs_callback_t callback, void *arg)
+{
+		return fs_write_async_h(defaultFs, fd, buf, count, callback, arg);
+}
+
+int fs_async_wait(void)
+{
+		return fs_async_wait_h(defaultFs);
+}
+
+int fs_fallocate(int fd, size_t len)
+{
+		return fs_fallocate_h(defaultFs, fd, len);
+}
+
+int fs_truncate(int fd, size_t len)
+{
+		return fs_truncate_h(defaultFs, fd, len);
+}
@@ -2,16 +2,169 @@
 #define _FS_H
 
 #include <stddef.h> /* for size_t definition */
+#include <sys/uio.h> /* for struct iovec definition */
 
 /** Maximum filename length (including the NULL character) */
 #define FS_FILENAME_LEN 16
 
-/** Maximum number of files in the root directory */
+/**
+ * Maximum number of files in the root directory of a disk in the original
+ * format. Disks made by fs_format() can hold more, see fs_statfs().
+ */
 #define FS_FILE_MAX_COUNT 128
 
 /** Maximum number of open files */
 #define FS_OPEN_MAX_COUNT 32
 
+/** Default number of blocks held by the block cache */
+#define FS_CACHE_DEFAULT_BLOCKS 64
+
+/** Ways of accessing the virtual disk */
+enum {
+	/** Blocks are read and written with system calls */
+	FS_DISK_FILE,
+	/** Whole virtual disk is memory-mapped */
+	FS_DISK_MMAP,
+};
+
+/** Ways of loading the FAT */
+enum {
+	/** Every FAT block is read when the file system is mounted */
+	FS_FAT_EAGER,
+	/** FAT blocks are read the first time one of their entries is needed */
+	FS_FAT_LAZY,
+};
+
+/** Block cache statistics */
+struct fs_cache_stats {
+	/** Number of block accesses served from memory */
+	size_t hits;
+	/** Number of block accesses that went to the disk */
+	size_t misses;
+	/** Number of blocks evicted from the cache */
+	size_t evictions;
+	/** Number of dirty blocks written back to the disk */
+	size_t writebacks;
+	/** Number of blocks read ahead by sequential reads */
+	size_t prefetches;
+};
+
+/** File system usage, as displayed by fs_info() */
+struct fs_statfs {
+	/** Total number of blocks of the virtual disk */
+	size_t total_blk_count;
+	/** Number of FAT blocks */
+	size_t fat_blk_count;
+	/** Index of the root directory block */
+	size_t rdir_blk;
+	/** Index of the first data block */
+	size_t data_blk;
+	/** Number of data blocks */
+	size_t data_blk_count;
+	/** Number of free data blocks */
+	size_t data_blk_free;
+	/** Number of entries in the root directory */
+	size_t rdir_count;
+	/** Number of free entries in the root directory */
+	size_t rdir_free;
+	/** Size of a block in bytes, 4096 unless formatted with fs_format() */
+	size_t blk_size;
+};
+
+/** Operations measured by fs_stats() */
+enum {
+	/** Entry points, measured by the fs_*() and fs_*_h() functions alike */
+	FS_OP_MOUNT,
+	FS_OP_UMOUNT,
+	FS_OP_FLUSH,
+	FS_OP_SYNC,
+	FS_OP_STATFS,
+	FS_OP_CREATE,
+	FS_OP_DELETE,
+	FS_OP_LS,
+	FS_OP_OPEN,
+	FS_OP_CLOSE,
+	FS_OP_STAT,
+	FS_OP_LSEEK,
+	FS_OP_READ,
+	FS_OP_WRITE,
+	FS_OP_PREAD,
+	FS_OP_PWRITE,
+	FS_OP_READV,
+	FS_OP_WRITEV,
+	FS_OP_READ_ASYNC,
+	FS_OP_WRITE_ASYNC,
+	FS_OP_ASYNC_WAIT,
+	FS_OP_FALLOCATE,
+	FS_OP_TRUNCATE,
+	/** Steps taken by the entry points */
+	FS_OP_LOOKUP,
+	FS_OP_FAT_WALK,
+	FS_OP_ALLOC,
+	FS_OP_COMMIT,
+	/** Block layer, below the block cache */
+	FS_OP_BLOCK_READ,
+	FS_OP_BLOCK_WRITE,
+	FS_OP_BLOCK_READV,
+	FS_OP_BLOCK_WRITEV,
+	FS_OP_BLOCK_SUBMIT,
+	FS_OP_BLOCK_SYNC,
+	FS_OP_COUNT
+};
+
+/** Number of buckets of the latency histograms */
+#define FS_STATS_BUCKETS 32
+
+/** Counters of one operation */
+struct fs_op_stats {
+	/** Number of calls */
+	size_t calls;
+	/** Number of bytes read or written by the calls */
+	size_t bytes;
+	/** Number of blocks read from the virtual disk during the calls */
+	size_t blocks_read;
+	/** Number of blocks written to the virtual disk during the calls */
+	size_t blocks_written;
+	/** Total time spent in the calls, in nanoseconds */
+	size_t total_ns;
+	/** Number of calls that took from 2^i to 2^(i+1) ns, in bucket i */
+	size_t latency[FS_STATS_BUCKETS];
+};
+
+/** Statistics of every operation, indexed by %FS_OP_MOUNT and the like */
+struct fs_stats {
+	struct fs_op_stats ops[FS_OP_COUNT];
+};
+
+/**
+ * fs_format - Create a virtual disk in the extended format
+ * @diskname: Name of the virtual disk file to create
+ * @data_blk_count: Number of data blocks
+ * @block_size: Size of every block in bytes
+ * @file_count: Number of files the root directory must be able to hold
+ *
+ * Create virtual disk file @diskname, replacing any existing file, and format
+ * it with an empty file system of @data_blk_count data blocks. The extended
+ * format differs from the original one made by fs_make.x in its 32-bit FAT
+ * entries and block counts, which allow up to 2^31 data blocks, and in its
+ * block size, a power of two from 4096 to 65536 bytes. The format is
+ * recorded in bytes of the superblock that the original format leaves unused,
+ * and tools that only know the original format refuse to mount it. fs_mount()
+ * mounts both formats. Files still hold at most 2 GiB.
+ *
+ * The root directory takes as many blocks as needed to hold @file_count files,
+ * each block holding @block_size / 32 of them. Files are hashed by filename
+ * to a home block, so that looking a file up only reads its home block, and
+ * the following ones in the rare case where the home block is full. Root
+ * directory blocks are read the first time a lookup needs them, except
+ * fs_ls() and fs_statfs() which need all of them.
+ *
+ * Return: -1 if @block_size, @data_blk_count or @file_count is invalid, or if
+ * the virtual disk file cannot be created. 0 otherwise.
+ */
+int fs_format(const char *diskname, size_t data_blk_count, size_t block_size,
+	      size_t file_count);
+
 /**
  * fs_mount - Mount a file system
  * @diskname: Name of the virtual disk file
@@ -20,8 +173,15 @@
  * contains. A file system needs to be mounted before files can be read from it
  * with fs_read() or written to it with fs_write().
  *
- * Return: -1 if virtual disk file @diskname cannot be opened, or if no valid
- * file system can be located. 0 otherwise.
+ * Once a file system is mounted, every other function can be called from
+ * several threads at once. Files are locked independently, so operations on
+ * different files run in parallel, as do reads of the same file. Operations on
+ * a same file descriptor are serialized. fs_mount(), fs_umount() and the
+ * fs_set_*() functions must not run concurrently with any other function.
+ *
+ * Return: -1 if a file system is already mounted, if virtual disk file
+ * @diskname cannot be opened, or if no valid file system can be located. 0
+ * otherwise.
  */
 int fs_mount(const char *diskname);
 
@@ -29,13 +189,141 @@ int fs_mount(const char *diskname);
  * fs_umount - Unmount file system
  *
  * Unmount the currently mounted file system and close the underlying virtual
- * disk file.
+ * disk file. Pending asynchronous operations are completed first.
+ *
+ * If cached data or metadata cannot be written back, the file system remains
+ * mounted and fs_umount() can be called again. Once everything is written
+ * back, the file system is unmounted even if the virtual disk file then fails
+ * to close.
  *
  * Return: -1 if no FS is currently mounted, or if the virtual disk cannot be
- * closed, or if there are still open file descriptors. 0 otherwise.
+ * written back or closed, or if there are still open file descriptors. 0
+ * otherwise.
  */
 int fs_umount(void);
 
+/**
+ * fs_set_cache_size - Set the size of the block cache
+ * @nblocks: Number of blocks held by the cache
+ *
+ * Set the number of data blocks that the write-back block cache of the next
+ * mounted file system can hold. Data blocks read or written by fs_read() and
+ * fs_write() are kept in memory and dirty blocks are only written to disk when
+ * evicted, when fs_flush() is called or when the file system is unmounted. A
+ * size of 0 disables the cache. The default size is %FS_CACHE_DEFAULT_BLOCKS.
+ *
+ * Return: -1 if a FS is currently mounted. 0 otherwise.
+ */
+int fs_set_cache_size(size_t nblocks);
+
+/**
+ * fs_set_disk_backend - Select how the virtual disk is accessed
+ * @backend: %FS_DISK_FILE or %FS_DISK_MMAP
+ *
+ * Select how the next mounted file system accesses its virtual disk file. With
+ * %FS_DISK_MMAP, the whole virtual disk file is mapped in memory and fs_read()
+ * copies file contents straight from the mapping into the caller's buffer. The
+ * block cache is not used in this mode. The default is %FS_DISK_FILE.
+ *
+ * Return: -1 if a FS is currently mounted, or if @backend is invalid. 0
+ * otherwise.
+ */
+int fs_set_disk_backend(int backend);
+
+/**
+ * fs_set_fat_loading - Select when FAT blocks are read
+ * @mode: %FS_FAT_EAGER or %FS_FAT_LAZY
+ *
+ * Select how the next mounted file system loads its FAT. With %FS_FAT_LAZY,
+ * fs_mount() does not read any FAT block: each one is read, and its free data
+ * blocks indexed, the first time one of its entries is needed. Mounting a large
+ * virtual disk to access a few files is then nearly constant time. Operations
+ * that need the whole FAT, such as fs_statfs() or allocating a contiguous run
+ * of blocks, load the remaining FAT blocks. The default is %FS_FAT_EAGER.
+ *
+ * Return: -1 if a FS is currently mounted, or if @mode is invalid. 0
+ * otherwise.
+ */
+int fs_set_fat_loading(int mode);
+
+/**
+ * fs_set_journal_size - Reserve a metadata journal
+ * @nblocks: Number of journal blocks, 0 for no journal
+ *
+ * Make the next fs_mount() reserve a journal of @nblocks contiguous data blocks
+ * if the virtual disk does not have one yet. The journal blocks are marked as
+ * used in the FAT, and their location is recorded in unused bytes of the
+ * superblock, so the disk remains readable by implementations that ignore it.
+ * A disk that has a journal always uses it, whatever this setting.
+ *
+ * With a journal, fs_create(), fs_delete(), fs_close(), fs_truncate(),
+ * fs_fallocate() and fs_sync() return once the FAT and root directory entries
+ * modified so far are durable: the data blocks are flushed, then the new value
+ * of every modified entry is appended to the journal as a compact record, with
+ * a single sequential write. Updates made by other threads meanwhile are
+ * committed together. These functions also return -1 if the commit fails. When
+ * the journal is full, the updates it holds are written to their blocks, and
+ * the journal starts over with the new ones. Only updates too many for the
+ * whole journal are written straight to their blocks, and a crash then may
+ * leave them partially written. fs_mount() replays the committed updates that
+ * did not reach their blocks before a crash. The default is 0.
+ *
+ * Return: -1 if a FS is currently mounted, or if @nblocks is larger than 65535.
+ * 0 otherwise.
+ */
+int fs_set_journal_size(size_t nblocks);
+
+/**
+ * fs_set_trace - Record the block accesses of the next mounted file system
+ * @filename: Name of the trace file, NULL to record nothing
+ *
+ * Make the next fs_mount() record every block read from or written to the
+ * virtual disk, and every sync, until fs_umount(). Each access is appended to
+ * trace file @filename as a compact binary record giving its blocks, direction,
+ * time and the fs_*() function it was made from. Accesses served by the block
+ * cache are not recorded, nor are file contents read in place with
+ * %FS_DISK_MMAP. Traces can be replayed with trace_replay.x. The default is
+ * NULL.
+ *
+ * Return: -1 if a FS is currently mounted, or if memory cannot be allocated. 0
+ * otherwise.
+ */
+int fs_set_trace(const char *filename);
+
+/**
+ * fs_flush - Write cached data back to disk
+ *
+ * Write every dirty block held by the block cache back to the virtual disk.
+ *
+ * Return: -1 if no FS is currently mounted, or if a block cannot be written.
+ * 0 otherwise.
+ */
+int fs_flush(void);
+
+/**
+ * fs_sync - Write all modifications to disk
+ *
+ * Write every dirty block held by the block cache back to the virtual disk,
+ * followed by the FAT blocks and the root directory if they were modified since
+ * they were last written. Unmodified metadata blocks are not rewritten, so
+ * calling fs_sync() periodically is cheap and bounds the amount of work lost if
+ * the program stops without unmounting the file system. If the disk has a
+ * journal, the modified metadata is committed to the journal instead (see
+ * fs_set_journal_size()).
+ *
+ * Return: -1 if no FS is currently mounted, or if a block cannot be written.
+ * 0 otherwise.
+ */
+int fs_sync(void);
+
+/**
+ * fs_cache_stats - Get block cache statistics
+ * @stats: Structure to be filled with the cache counters
+ *
+ * Return: -1 if no FS is currently mounted, or if @stats is NULL. 0 otherwise.
+ */
+int fs_cache_stats(struct fs_cache_stats *stats);
+
 /**
  * fs_info - Display information about file system
  *
@@ -45,6 +333,61 @@ int fs_umount(void);
  */
 int fs_info(void);
 
+/**
+ * fs_statfs - Get file system usage
+ * @stats: Structure to be filled with the file system counts
+ *
+ * Get the information displayed by fs_info() about the currently mounted file
+ * system. The counts of free data blocks and free root directory entries are
+ * maintained as files are modified, so this operation takes constant time once
+ * every FAT block and root directory block is loaded. With %FS_FAT_LAZY, or
+ * with a root directory of several blocks, the first call reads the blocks that
+ * are not loaded yet, in time proportional to their number.
+ *
+ * Return: -1 if no FS is currently mounted, if @stats is NULL, or if a FAT or
+ * root directory block cannot be read. 0 otherwise.
+ */
+int fs_statfs(struct fs_statfs *stats);
+
+/**
+ * fs_stats - Get per-operation statistics
+ * @stats: Structure to be filled with the counters of every operation
+ *
+ * Get the counters of every operation since the program started or since
+ * fs_stats_reset() was last called. They are kept for the whole process, so
+ * they cover every mounted file system. Blocks are counted in the block layer
+ * call that transfers them as well as in each operation it was made from: a
+ * block read while walking a FAT chain for fs_read() counts in
+ * %FS_OP_BLOCK_READ, %FS_OP_FAT_WALK and %FS_OP_READ. Blocks served by the
+ * block cache are not counted.
+ *
+ * Statistics are only gathered when the library is compiled with %FS_STATS
+ * defined, which make STATS=1 does. Otherwise, this function fails, and
+ * operations only keep track of the fs_*() function that block accesses are
+ * made from, for block traces, at the cost of a few thread-local variable
+ * accesses per call.
+ *
+ * Return: -1 if the library is built without statistics, or if @stats is NULL.
+ * 0 otherwise.
+ */
+int fs_stats(struct fs_stats *stats);
+
+/**
+ * fs_stats_reset - Reset per-operation statistics
+ *
+ * Return: -1 if the library is built without statistics. 0 otherwise.
+ */
+int fs_stats_reset(void);
+
+/**
+ * fs_stats_name - Get the name of an operation
+ * @op: Operation, such as %FS_OP_READ
+ *
+ * Return: NULL if @op is invalid. Otherwise, a short name for @op, such as
+ * "read" or "block_read".
+ */
+const char *fs_stats_name(int op);
+
 /**
  * fs_create - Create a new file
  * @filename: File name
@@ -56,7 +399,9 @@ int fs_info(void);
  *
  * Return: -1 if no FS is currently mounted, or if @filename is invalid, or if a
  * file named @filename already exists, or if string @filename is too long, or
- * if the root directory already contains %FS_FILE_MAX_COUNT files. 0 otherwise.
+ * if the root directory is full. It holds %FS_FILE_MAX_COUNT files on a disk in
+ * the original format, and the number of entries given by the superblock on a
+ * disk made by fs_format() (see rdir_count in fs_statfs()). 0 otherwise.
  */
 int fs_create(const char *filename);
 
@@ -176,10 +521,235 @@ int fs_write(int fd, void *buf, size_t count);
  * is at the end of the file). The file offset of the file descriptor is
  * implicitly incremented by the number of bytes that were actually read.
  *
+ * While a file descriptor is read sequentially, the blocks that follow are
+ * read ahead into the block cache, a few at first and up to half of the cache
+ * as long as the reads stay sequential, so that small reads are served from
+ * memory.
+ *
  * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
  * invalid (out of bounds or not currently open), or if @buf is NULL. Otherwise
  * return the number of bytes actually read.
  */
 int fs_read(int fd, void *buf, size_t count);
 
+/**
+ * fs_pwrite - Write to a file at a given offset
+ * @fd: File descriptor
+ * @buf: Data buffer to write in the file
+ * @count: Number of bytes of data to be written
+ * @offset: Offset in the file where to start writing
+ *
+ * Same as fs_write(), except that the data is written at offset @offset, and
+ * that the file offset of the file descriptor is left unchanged.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if @buf is NULL, or if
+ * @offset is larger than the current file size. Otherwise return the number of
+ * bytes actually written.
+ */
+int fs_pwrite(int fd, void *buf, size_t count, size_t offset);
+
+/**
+ * fs_pread - Read from a file at a given offset
+ * @fd: File descriptor
+ * @buf: Data buffer to be filled with data
+ * @count: Number of bytes of data to be read
+ * @offset: Offset in the file where to start reading
+ *
+ * Same as fs_read(), except that the data is read from offset @offset, and
+ * that the file offset of the file descriptor is left unchanged.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if @buf is NULL, or if
+ * @offset is larger than the current file size. Otherwise return the number of
+ * bytes actually read.
+ */
+int fs_pread(int fd, void *buf, size_t count, size_t offset);
+
+/**
+ * fs_writev - Write to a file from several buffers
+ * @fd: File descriptor
+ * @iov: Array of buffers
+ * @iovcnt: Number of buffers in @iov
+ *
+ * Write the @iovcnt buffers of @iov, in order, as a single fs_write() of their
+ * concatenation. The buffers are written in place, without being copied into
+ * a single one first. In particular, the blocks shared by consecutive buffers
+ * are only read and written once. At most %INT32_MAX bytes are written.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if @iov is NULL or
+ * @iovcnt is not positive, or if a buffer of @iov is NULL. Otherwise return the
+ * number of bytes actually written.
+ */
+int fs_writev(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * fs_readv - Read from a file into several buffers
+ * @fd: File descriptor
+ * @iov: Array of buffers
+ * @iovcnt: Number of buffers in @iov
+ *
+ * Read as a single fs_read() as many bytes as the @iovcnt buffers of @iov can
+ * hold, and fill the buffers in order, straight from the blocks of the file. At
+ * most %INT32_MAX bytes are read.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if @iov is NULL or
+ * @iovcnt is not positive, or if a buffer of @iov is NULL. Otherwise return the
+ * number of bytes actually read.
+ */
+int fs_readv(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * typedef fs_callback_t - Completion callback of an asynchronous operation
+ * @fd: File descriptor the operation was submitted on
+ * @ret: Return value of the operation, as fs_read() or fs_write() returns it
+ * @arg: Argument given when the operation was submitted
+ */
+typedef void (*fs_callback_t)(int fd, int ret, void *arg);
+
+/**
+ * fs_read_async - Read from a file asynchronously
+ * @fd: File descriptor
+ * @buf: Data buffer to be filled with data
+ * @count: Number of bytes of data to be read
+ * @callback: Function called once the read completes, or NULL
+ * @arg: Argument given to @callback
+ *
+ * Queue a fs_read() of @count bytes from file descriptor @fd into @buf, and
+ * return without waiting for it. The read is performed by a pool of worker
+ * threads, which call @callback with its result once it completes. @buf must
+ * remain valid until then. Operations submitted on a same file descriptor are
+ * performed in order, while those on different ones overlap, and their block
+ * requests are submitted to the disk in batches through io_uring when it is
+ * available.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is out of
+ * bounds, or if the read cannot be queued. 0 otherwise, any other error is
+ * reported to @callback.
+ */
+int fs_read_async(int fd, void *buf, size_t count, fs_callback_t callback,
+		  void *arg);
+
+/**
+ * fs_write_async - Write to a file asynchronously
+ * @fd: File descriptor
+ * @buf: Data buffer to write in the file
+ * @count: Number of bytes to be written
+ * @callback: Function called once the write completes, or NULL
+ * @arg: Argument given to @callback
+ *
+ * Same as fs_read_async(), but queue a fs_write().
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is out of
+ * bounds, or if the write cannot be queued. 0 otherwise.
+ */
+int fs_write_async(int fd, void *buf, size_t count, fs_callback_t callback,
+		   void *arg);
+
+/**
+ * fs_async_wait - Wait for the completion of asynchronous operations
+ *
+ * Return once every operation submitted so far with fs_read_async() or
+ * fs_write_async() has completed and its callback has returned.
+ *
+ * Return: -1 if no FS is currently mounted. 0 otherwise.
+ */
+int fs_async_wait(void);
+
+/**
+ * fs_fallocate - Preallocate space for a file
+ * @fd: File descriptor
+ * @len: Number of bytes to reserve, from the beginning of the file
+ *
+ * Make sure that the data blocks needed to hold the first @len bytes of the
+ * file referenced by file descriptor @fd are allocated, reserving the missing
+ * ones as contiguous runs. The size of the file is not changed: subsequent
+ * writes up to @len bytes use the reserved blocks and do not need to allocate
+ * any. Reserved blocks past the end of the file are released by
+ * fs_truncate() or fs_delete().
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if there is not enough
+ * space on disk (in which case nothing is reserved). 0 otherwise.
+ */
+int fs_fallocate(int fd, size_t len);
+
+/**
+ * fs_truncate - Change the size of a file
+ * @fd: File descriptor
+ * @len: New size of the file
+ *
+ * Set the size of the file referenced by file descriptor @fd to @len bytes. If
+ * the file was larger, the extra data is discarded. If it was smaller, it is
+ * extended with zeros. Data blocks past the new end of the file, including
+ * blocks reserved by fs_fallocate(), are released. The offset of file
+ * descriptors that would end up past the end of the file is set to @len.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if there is not enough
+ * space on disk to extend the file. 0 otherwise.
+ */
+int fs_truncate(int fd, size_t len);
+
+/** Mounted file system, for the handle-based API */
+typedef struct fs fs_t;
+
+/**
+ * fs_mount_h - Mount a file system and return a handle to it
+ * @diskname: Name of the virtual disk file
+ *
+ * Same as fs_mount(), but several file systems, each on its own virtual disk,
+ * can be mounted at the same time, independently of the one mounted with
+ * fs_mount(). The mount options set with the fs_set_*() functions apply.
+ *
+ * Return: NULL if virtual disk file @diskname cannot be opened, or if no valid
+ * file system can be located. Otherwise, a handle to the mounted file system.
+ */
+fs_t *fs_mount_h(const char *diskname);
+
+/**
+ * fs_umount_h - Unmount a file system mounted with fs_mount_h()
+ * @fs: File system to unmount
+ *
+ * Same as fs_umount(). The handle becomes invalid once the file system is
+ * unmounted.
+ *
+ * Return: -1 if @fs is NULL, or if there are still open file descriptors on
+ * it, or if it cannot be written back to disk. 0 otherwise.
+ */
+int fs_umount_h(fs_t *fs);
+
+/*
+ * Each of the following functions behaves as the function of the same name
+ * without the _h suffix, but on file system @fs. File descriptors are specific
+ * to the file system they were opened on.
+ */
+int fs_flush_h(fs_t *fs);
+int fs_sync_h(fs_t *fs);
+int fs_cache_stats_h(fs_t *fs, struct fs_cache_stats *stats);
+int fs_statfs_h(fs_t *fs, struct fs_statfs *stats);
+int fs_info_h(fs_t *fs);
+int fs_create_h(fs_t *fs, const char *filename);
+int fs_delete_h(fs_t *fs, const char *filename);
+int fs_ls_h(fs_t *fs);
+int fs_open_h(fs_t *fs, const char *filename);
+int fs_close_h(fs_t *fs, int fd);
+int fs_stat_h(fs_t *fs, int fd);
+int fs_lseek_h(fs_t *fs, int fd, size_t offset);
+int fs_write_h(fs_t *fs, int fd, void *buf, size_t count);
+int fs_read_h(fs_t *fs, int fd, void *buf, size_t count);
+int fs_pwrite_h(fs_t *fs, int fd, void *buf, size_t count, size_t offset);
+int fs_pread_h(fs_t *fs, int fd, void *buf, size_t count, size_t offset);
+int fs_writev_h(fs_t *fs, int fd, const struct iovec *iov, int iovcnt);
+int fs_readv_h(fs_t *fs, int fd, const struct iovec *iov, int iovcnt);
+int fs_read_async_h(fs_t *fs, int fd, void *buf, size_t count,
+		    fs_callback_t callback, void *arg);
+int fs_write_async_h(fs_t *fs, int fd, void *buf, size_t count,
+		     fs_callback_t callback, void *arg);
+int fs_async_wait_h(fs_t *fs);
+int fs_fallocate_h(fs_t *fs, int fd, size_t len);
+int fs_truncate_h(fs_t *fs, int fd, size_t len);
+
 #endif /* _FS_H */
@@ -0,0 +1,172 @@
+#include <time.h>
+
+#include "stats.h"
+
+/* Deepest nesting of operations whose blocks are counted */
+#define STATS_DEPTH 8
+
+static const char *const stats_names[FS_OP_COUNT] = {
+	[FS_OP_MOUNT] = "mount",
+	[FS_OP_UMOUNT] = "umount",
+	[FS_OP_FLUSH] = "flush",
+	[FS_OP_SYNC] = "sync",
+	[FS_OP_STATFS] = "statfs",
+	[FS_OP_CREATE] = "create",
+	[FS_OP_DELETE] = "delete",
+	[FS_OP_LS] = "ls",
+	[FS_OP_OPEN] = "open",
+	[FS_OP_CLOSE] = "close",
+	[FS_OP_STAT] = "stat",
+	[FS_OP_LSEEK] = "lseek",
+	[FS_OP_READ] = "read",
+	[FS_OP_WRITE] = "write",
+	[FS_OP_PREAD] = "pread",
+	[FS_OP_PWRITE] = "pwrite",
+	[FS_OP_READV] = "readv",
+	[FS_OP_WRITEV] = "writev",
+	[FS_OP_READ_ASYNC] = "read_async",
+	[FS_OP_WRITE_ASYNC] = "write_async",
+	[FS_OP_ASYNC_WAIT] = "async_wait",
+	[FS_OP_FALLOCATE] = "fallocate",
+	[FS_OP_TRUNCATE] = "truncate",
+	[FS_OP_LOOKUP] = "lookup",
+	[FS_OP_FAT_WALK] = "fat_walk",
+	[FS_OP_ALLOC] = "alloc",
+	[FS_OP_COMMIT] = "commit",
+	[FS_OP_BLOCK_READ] = "block_read",
+	[FS_OP_BLOCK_WRITE] = "block_write",
+	[FS_OP_BLOCK_READV] = "block_readv",
+	[FS_OP_BLOCK_WRITEV] = "block_writev",
+	[FS_OP_BLOCK_SUBMIT] = "block_submit",
+	[FS_OP_BLOCK_SYNC] = "block_sync",
+};
+
+#ifdef FS_STATS
+
+/* Counters of the whole process, only accessed atomically */
+static struct fs_stats stats;
+
+/* Operations being measured in the calling thread, innermost last */
+static __thread int active[STATS_DEPTH];
+static __thread int depth;
+
+static void counter_add(size_t *counter, size_t n)
+{
+	__atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+static size_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (size_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Bucket i holds latencies from 2^i to 2^(i+1) ns, the last one the rest */
+static int latency_bucket(size_t ns)
+{
+	int bucket;
+
+	if (!ns)
+		return 0;
+
+	bucket = 63 - __builtin_clzll(ns);
+	if (bucket >= FS_STATS_BUCKETS)
+		bucket = FS_STATS_BUCKETS - 1;
+	return bucket;
+}
+
+struct stats_op stats_begin(int op)
+{
+	struct stats_op sop;
+
+	if (depth < STATS_DEPTH)
+		active[depth] = op;
+	depth++;
+
+	sop.op = op;
+	sop.bytes = 0;
+	sop.start = now_ns();
+	return sop;
+}
+
+void stats_end(struct stats_op *sop)
+{
+	struct fs_op_stats *op = &stats.ops[sop->op];
+	size_t ns = now_ns() - sop->start;
+
+	depth--;
+
+	counter_add(&op->calls, 1);
+	if (sop->bytes > 0)
+		counter_add(&op->bytes, sop->bytes);
+	counter_add(&op->total_ns, ns);
+	counter_add(&op->latency[latency_bucket(ns)], 1);
+}
+
+void stats_blocks(size_t count, int is_write)
+{
+	struct fs_op_stats *op;
+	int i;
+
+	for (i = 0; i < depth && i < STATS_DEPTH; i++) {
+		op = &stats.ops[active[i]];
+		counter_add(is_write ? &op->blocks_written : &op->blocks_read,
+			    count);
+	}
+}
+
+int stats_get(struct fs_stats *out)
+{
+	const size_t *src = (const size_t *)&stats;
+	size_t *dst = (size_t *)out;
+	size_t i;
+
+	/* The structure is made of counters only */
+	for (i = 0; i < sizeof(stats) / sizeof(size_t); i++)
+		dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+int stats_reset(void)
+{
+	size_t *counters = (size_t *)&stats;
+	size_t i;
+
+	for (i = 0; i < sizeof(stats) / sizeof(size_t); i++)
+		__atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+#else
+
+int stats_get(struct fs_stats *out)
+{
+	(void)out;
+	return -1;
+}
+
+int stats_reset(void)
+{
+	return -1;
+}
+
+#endif /* FS_STATS */
+
+__thread int stats_current_origin = -1;
+
+int stats_origin(void)
+{
+	return stats_current_origin;
+}
+
+const char *stats_name(int op)
+{
+	if (op < 0 || op >= FS_OP_COUNT)
+		return NULL;
+
+	return stats_names[op];
+}
@@ -0,0 +1,128 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stddef.h> /* for size_t definition */
+
+#include "fs.h"
+
+/*
+ * Outermost operation running in the calling thread, -1 if none. It is tracked
+ * whether or not %FS_STATS is defined, so that block traces can always tell
+ * which operation an access was made from.
+ */
+extern __thread int stats_current_origin;
+
+static inline int stats_enter(int op)
+{
+	int prev = stats_current_origin;
+
+	if (prev < 0)
+		stats_current_origin = op;
+	return prev;
+}
+
+static inline void stats_leave(int *prev)
+{
+	stats_current_origin = *prev;
+}
+
+/* Make the enclosing function the origin of the calling thread's accesses */
+#define STATS_ORIGIN(op) \
+	int stats_origin_ __attribute__((cleanup(stats_leave))) = stats_enter(op)
+
+/*
+ * Measurements are only compiled in when %FS_STATS is defined. Otherwise, the
+ * macros below only track the origin, which costs a few thread-local variable
+ * accesses per instrumented call.
+ */
+#ifdef FS_STATS
+
+/** Operation being measured */
+struct stats_op {
+	/* Operation, such as %FS_OP_READ */
+	int op;
+	/* Time at which the operation started, in nanoseconds */
+	size_t start;
+	/* Number of bytes transferred, if positive */
+	long bytes;
+};
+
+/**
+ * stats_begin - Start measuring an operation
+ * @op: Operation, such as %FS_OP_READ
+ *
+ * Return: The operation being measured, to be given to stats_end().
+ */
+struct stats_op stats_begin(int op);
+
+/**
+ * stats_end - Stop measuring an operation
+ * @sop: Operation returned by stats_begin()
+ *
+ * Operations must end in the reverse order they began in the same thread.
+ */
+void stats_end(struct stats_op *sop);
+
+/**
+ * stats_blocks - Count blocks transferred by the block layer
+ * @count: Number of blocks
+ * @is_write: Blocks are written rather than read
+ *
+ * Count @count blocks in every operation being measured in the calling thread.
+ */
+void stats_blocks(size_t count, int is_write);
+
+/*
+ * Measure the enclosing function, from this point to whichever return ends it.
+ * Only one operation can be measured per function.
+ */
+#define STATS_OP(op) \
+	STATS_ORIGIN(op); \
+	struct stats_op stats_op_ __attribute__((cleanup(stats_end))) = \
+		stats_begin(op)
+/* Record the number of bytes transferred by the measured operation */
+#define STATS_BYTES(n) (stats_op_.bytes = (n))
+#define STATS_BLOCKS(count, is_write) stats_blocks(count, is_write)
+
+#else
+
+#define STATS_OP(op) STATS_ORIGIN(op)
+#define STATS_BYTES(n) do { } while (0)
+#define STATS_BLOCKS(count, is_write) do { } while (0)
+
+#endif /* FS_STATS */
+
+/**
+ * stats_get - Get the statistics of every operation
+ * @stats: Structure to be filled with the counters
+ *
+ * Return: -1 if the statistics are not compiled in. 0 otherwise.
+ */
+int stats_get(struct fs_stats *stats);
+
+/**
+ * stats_reset - Reset the statistics of every operation
+ *
+ * Return: -1 if the statistics are not compiled in. 0 otherwise.
+ */
+int stats_reset(void);
+
+/**
+ * stats_origin - Get the outermost operation running in the calling thread
+ *
+ * The origin is tracked even when the statistics are not compiled in.
+ *
+ * Return: -1 if no operation is running. Otherwise, the operation, such as
+ * %FS_OP_READ.
+ */
+int stats_origin(void);
+
+/**
+ * stats_name - Get the name of an operation
+ * @op: Operation, such as %FS_OP_READ
+ *
+ * Return: NULL if @op is invalid. Otherwise, the name of @op.
+ */
+const char *stats_name(int op);
+
+#endif /* _STATS_H */